@@ -0,0 +1,78 @@
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "mem.h"
+#include "tcache.h"
+
+static size_t mem_mapped_bytes( void ) { return heap_stats().mapped_bytes; }
+
+static size_t glibc_mapped_bytes( void ) {
+  const struct mallinfo2 info = mallinfo2();
+  return info.arena + info.hblkhd;
+}
+
+const struct allocator allocator_mem = { "mem", _malloc, _free, _realloc, mem_mapped_bytes };
+const struct allocator allocator_tcache = { "tcache", tcache_malloc, tcache_free, _realloc, mem_mapped_bytes };
+const struct allocator allocator_glibc = { "glibc", malloc, free, realloc, glibc_mapped_bytes };
+
+const struct allocator* allocator_find( const char* name ) {
+  if (strcmp( name, allocator_mem.name ) == 0) return &allocator_mem;
+  if (strcmp( name, allocator_tcache.name ) == 0) return &allocator_tcache;
+  if (strcmp( name, allocator_glibc.name ) == 0) return &allocator_glibc;
+  return NULL;
+}
+
+double bench_seconds( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/*  без stdio: fopen сам выделяет память и исказил бы замер glibc */
+size_t bench_rss_bytes( void ) {
+  const int fd = open( "/proc/self/statm", O_RDONLY );
+  if (fd < 0) return 0;
+  char text[128];
+  const ssize_t length = read( fd, text, sizeof( text ) - 1 );
+  close( fd );
+  if (length <= 0) return 0;
+  text[length] = 0;
+  size_t size = 0, resident = 0, shared = 0;
+  if (sscanf( text, "%zu %zu %zu", &size, &resident, &shared ) != 3) return 0;
+  return (resident - shared) * getpagesize();
+}
+
+uint64_t bench_random( uint64_t* state ) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1Dull;
+}
+
+size_t bench_random_size( uint64_t* state, size_t lo, size_t hi ) {
+  const size_t octaves = __builtin_ctzll( hi / lo );
+  const size_t base = lo << (bench_random( state ) % octaves);
+  return base + bench_random( state ) % base;
+}
+
+bool bench_isolated( void (*run)( void* arg ), void* arg ) {
+  fflush( stdout );
+  const pid_t pid = fork();
+  if (pid < 0) { perror( "fork" ); return false; }
+  if (pid == 0) {
+    run( arg );
+    fflush( stdout );
+    _exit( 0 );
+  }
+  int status;
+  if (waitpid( pid, &status, 0 ) < 0) return false;
+  return WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+}
@@ -0,0 +1,48 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*  Таблица функций аллокатора, через которую бенчмарки гоняют одну и ту же нагрузку
+    на разных реализациях. mapped_bytes -- сколько памяти аллокатор сейчас держит у ядра. */
+struct allocator {
+  const char* name;
+  void*  (*malloc)( size_t size );
+  void   (*free)( void* ptr );
+  void*  (*realloc)( void* ptr, size_t size );
+  size_t (*mapped_bytes)( void );
+};
+
+extern const struct allocator allocator_mem;
+/*  тот же аллокатор через кэш потока (tcache_malloc/tcache_free) */
+extern const struct allocator allocator_tcache;
+extern const struct allocator allocator_glibc;
+
+/*  аллокатор по имени ("mem", "tcache", "glibc") или NULL */
+const struct allocator* allocator_find( const char* name );
+
+double   bench_seconds( void );
+/*  резидентная анонимная память процесса в байтах (resident - shared из /proc/self/statm) */
+size_t   bench_rss_bytes( void );
+
+/*  xorshift64*: детерминированный и одинаковый на всех платформах; состояние не должно быть нулём */
+uint64_t bench_random( uint64_t* state );
+/*  размер из [lo, hi), равномерный по логарифму: на каждую октаву приходится поровну запросов;
+    hi / lo -- степень двойки не меньше 2 */
+size_t   bench_random_size( uint64_t* state, size_t lo, size_t hi );
+
+/*  выполнить run( arg ) в дочернем процессе, чтобы состояние аллокатора после замера
+    не влияло на следующие; false, если процесс завершился с ошибкой */
+bool     bench_isolated( void (*run)( void* arg ), void* arg );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+#define _DEFAULT_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "bench.h"
+
+/*  Долгий бенчмарк фрагментации. Нагрузка состоит из фаз; в каждой фазе задан диапазон размеров
+    и целевой объём живых данных (доля от -l). Пока живых данных меньше цели, блоки выделяются,
+    иначе освобождается случайный живой блок, то есть время жизни распределено экспоненциально.
+    Блоки "закреплённых" фаз не освобождаются никогда -- это долгоживущие структуры программы.
+    Фазы можно повторять (-c), имитируя многодневную работу.
+
+    По ходу работы снимаются отсчёты (время, живые байты, байты у ядра, RSS), в конце --
+    итог: пиковая фрагментация (пик отображённой памяти к пику живых данных, как у Johnstone и Wilson)
+    и установившаяся (среднее отношение отображённой памяти к живым данным по последней фазе). */
+
+#define DEFAULT_LIVE_LIMIT (4 << 20)
+#define DEFAULT_PHASE_OPS 50000
+#define SAMPLES_PER_PHASE 20
+#define PHASES_MAX 8
+
+struct phase {
+  const char* name;
+  size_t      min_size, max_size;
+  double      target;
+  bool        pinned;
+};
+
+struct workload {
+  const char*  name;
+  struct phase phases[PHASES_MAX];
+  size_t       phases_count;
+};
+
+/*  ramp    -- набор данных, освобождение большей части и заполнение дыр мелкими блоками;
+    shift   -- распределение размеров меняется при неизменном объёме живых данных;
+    peaks   -- профиль в духе трасс Wilson/Johnstone: небольшая долгоживущая основа и повторяющиеся
+               пики с резким спадом между ними */
+static const struct workload workloads[] = {
+  { "ramp", {
+      { "grow",       16,   4096, 1.0, false },
+      { "free",       16,   4096, 0.3, false },
+      { "refill",     16,    128, 1.0, false },
+    }, 3 },
+  { "shift", {
+      { "small",      16,    256, 1.0, false },
+      { "large",      1024, 16384, 1.0, false },
+      { "medium",     128,  2048, 1.0, false },
+      { "small",      16,    256, 1.0, false },
+    }, 4 },
+  { "peaks", {
+      { "base",       32,    512, 0.1, true },
+      { "peak",       16,   8192, 1.0, false },
+      { "trough",     16,   8192, 0.2, false },
+      { "peak",       64,   2048, 1.0, false },
+      { "trough",     64,   2048, 0.2, false },
+    }, 5 },
+};
+
+#define WORKLOADS_COUNT (sizeof( workloads ) / sizeof( workloads[0] ))
+
+struct block {
+  void*  ptr;
+  size_t size;
+};
+
+/*  первые pinned блоков никогда не освобождаются, случайная жертва выбирается из остальных */
+struct heap_model {
+  struct block* blocks;
+  size_t        capacity, count, pinned;
+  size_t        live;
+};
+
+struct frag_job {
+  const struct workload*  workload;
+  const struct allocator* allocator;
+  size_t                  live_limit;
+  size_t                  phase_ops;
+  size_t                  cycles;
+};
+
+struct frag_result {
+  size_t peak_live, peak_mapped, peak_rss;
+  double steady_sum;
+  size_t steady_samples;
+};
+
+static uint64_t rng_state;
+
+static void model_alloc( struct heap_model* m, const struct allocator* a, struct phase const* p, bool pinned ) {
+  if (m->count == m->capacity) return;
+  const size_t size = bench_random_size( &rng_state, p->min_size, p->max_size );
+  void* ptr = a->malloc( size );
+  if (!ptr) return;
+  memset( ptr, 0, size );
+  m->blocks[m->count] = (struct block) { ptr, size };
+  if (pinned) {
+    /*  закреплённый блок переносится в начало, на место первого незакреплённого */
+    const struct block moved = m->blocks[m->pinned];
+    m->blocks[m->pinned] = m->blocks[m->count];
+    m->blocks[m->count] = moved;
+    m->pinned++;
+  }
+  m->count++;
+  m->live += size;
+}
+
+static void model_free_random( struct heap_model* m, const struct allocator* a ) {
+  if (m->count == m->pinned) return;
+  const size_t k = m->pinned + bench_random( &rng_state ) % (m->count - m->pinned);
+  a->free( m->blocks[k].ptr );
+  m->live -= m->blocks[k].size;
+  m->blocks[k] = m->blocks[--m->count];
+}
+
+static void sample( struct frag_job const* job, struct heap_model const* m, struct frag_result* r,
+                    const char* phase, size_t cycle, size_t ops, double start, size_t rss_base, bool last_phase ) {
+  const size_t mapped = job->allocator->mapped_bytes();
+  const size_t rss_now = bench_rss_bytes();
+  const size_t rss = rss_now > rss_base ? rss_now - rss_base : 0;
+  if (m->live > r->peak_live) r->peak_live = m->live;
+  if (mapped > r->peak_mapped) r->peak_mapped = mapped;
+  if (rss > r->peak_rss) r->peak_rss = rss;
+  if (last_phase && m->live) {
+    r->steady_sum += (double) mapped / (double) m->live;
+    r->steady_samples++;
+  }
+  printf( "{\"workload\": \"%s\", \"allocator\": \"%s\", \"cycle\": %zu, \"phase\": \"%s\", \"ops\": %zu, "
+          "\"seconds\": %.3f, \"live_bytes\": %zu, \"mapped_bytes\": %zu, \"rss_bytes\": %zu}\n",
+          job->workload->name, job->allocator->name, cycle, phase, ops, bench_seconds() - start,
+          m->live, mapped, rss );
+}
+
+static void run_workload( void* arg ) {
+  struct frag_job const* job = arg;
+  const struct allocator* a = job->allocator;
+  rng_state = 42;
+
+  /*  самый мелкий блок -- 16 байт, больше блоков при таком пределе живых данных не бывает
+      (кроме закреплённых, которые тоже входят в предел) */
+  struct heap_model m = { .capacity = job->live_limit / 16 + 1 };
+  m.blocks = mmap( NULL, m.capacity * sizeof( struct block ), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0 );
+  if (m.blocks == MAP_FAILED) { perror( "mmap" ); exit( 1 ); }
+
+  struct frag_result r = {0};
+  const size_t rss_base = bench_rss_bytes();
+  const double start = bench_seconds();
+  size_t ops = 0;
+  const size_t sample_every = job->phase_ops / SAMPLES_PER_PHASE ? job->phase_ops / SAMPLES_PER_PHASE : 1;
+
+  for (size_t cycle = 0; cycle < job->cycles; cycle++)
+    for (size_t p = 0; p < job->workload->phases_count; p++) {
+      struct phase const* phase = &job->workload->phases[p];
+      const size_t target = (size_t) (phase->target * (double) job->live_limit);
+      const bool last_phase = cycle + 1 == job->cycles && p + 1 == job->workload->phases_count;
+      /*  закреплённая фаза только набирает долгоживущие блоки и делается один раз */
+      if (phase->pinned && cycle > 0) continue;
+      for (size_t i = 0; i < job->phase_ops; i++, ops++) {
+        if (m.live < target) model_alloc( &m, a, phase, phase->pinned );
+        else if (!phase->pinned) model_free_random( &m, a );
+        else break;
+        if (i % sample_every == sample_every - 1) sample( job, &m, &r, phase->name, cycle, ops, start, rss_base, last_phase );
+      }
+    }
+
+  printf( "{\"workload\": \"%s\", \"allocator\": \"%s\", \"config\": \"%s\", \"summary\": true, \"ops\": %zu, "
+          "\"seconds\": %.3f, \"peak_live_bytes\": %zu, \"peak_mapped_bytes\": %zu, \"peak_rss_bytes\": %zu, "
+          "\"peak_fragmentation\": %.4f, \"peak_rss_fragmentation\": %.4f, \"steady_fragmentation\": %.4f}\n",
+          job->workload->name, a->name, getenv( "MEM_CONF" ) ? getenv( "MEM_CONF" ) : "", ops,
+          bench_seconds() - start, r.peak_live, r.peak_mapped, r.peak_rss,
+          r.peak_live ? (double) r.peak_mapped / (double) r.peak_live : 0.0,
+          r.peak_live ? (double) r.peak_rss / (double) r.peak_live : 0.0,
+          r.steady_samples ? r.steady_sum / (double) r.steady_samples : 0.0 );
+
+  for (size_t i = 0; i < m.count; i++) a->free( m.blocks[i].ptr );
+  munmap( m.blocks, m.capacity * sizeof( struct block ) );
+}
+
+static void usage( const char* self ) {
+  fprintf( stderr, "usage: %s [-a mem|tcache|glibc]... [-l live_bytes] [-n ops_per_phase] [-c cycles] "
+                   "[ramp|shift|peaks]...\n", self );
+}
+
+/*  по умолчанию -- все нагрузки на mem и glibc, один цикл; настройки mem берутся из MEM_CONF */
+int main( int argc, char** argv ) {
+  const struct allocator* allocators[3];
+  size_t allocators_count = 0;
+  struct frag_job base = { .live_limit = DEFAULT_LIVE_LIMIT, .phase_ops = DEFAULT_PHASE_OPS, .cycles = 1 };
+  int opt;
+  while ((opt = getopt( argc, argv, "a:l:n:c:" )) != -1) {
+    switch (opt) {
+      case 'a':
+        if (allocators_count == 3 || !(allocators[allocators_count++] = allocator_find( optarg ))) {
+          usage( argv[0] );
+          return 2;
+        }
+        break;
+      case 'l': base.live_limit = strtoull( optarg, NULL, 0 ); break;
+      case 'n': base.phase_ops = strtoull( optarg, NULL, 0 ); break;
+      case 'c': base.cycles = strtoull( optarg, NULL, 0 ); break;
+      default: usage( argv[0] ); return 2;
+    }
+  }
+  if (base.live_limit == 0 || base.phase_ops == 0 || base.cycles == 0) { usage( argv[0] ); return 2; }
+  if (allocators_count == 0) {
+    allocators[allocators_count++] = &allocator_mem;
+    allocators[allocators_count++] = &allocator_glibc;
+  }
+
+  bool selected[WORKLOADS_COUNT] = {0};
+  bool any_selected = false;
+  for (int i = optind; i < argc; i++) {
+    size_t w = 0;
+    while (w < WORKLOADS_COUNT && strcmp( workloads[w].name, argv[i] ) != 0) w++;
+    if (w == WORKLOADS_COUNT) { usage( argv[0] ); return 2; }
+    selected[w] = any_selected = true;
+  }
+
+  bool ok = true;
+  for (size_t w = 0; w < WORKLOADS_COUNT; w++) {
+    if (any_selected && !selected[w]) continue;
+    for (size_t i = 0; i < allocators_count; i++) {
+      struct frag_job job = base;
+      job.workload = &workloads[w];
+      job.allocator = allocators[i];
+      if (!bench_isolated( run_workload, &job )) {
+        fprintf( stderr, "%s/%s failed\n", workloads[w].name, allocators[i]->name );
+        ok = false;
+      }
+    }
+  }
+  return ok ? 0 : 1;
+}
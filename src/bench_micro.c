@@ -0,0 +1,231 @@
+#define _DEFAULT_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "bench.h"
+
+/*  Микробенчмарки _malloc/_free/_realloc и glibc через одну и ту же таблицу struct allocator.
+    Каждый замер запускается в отдельном дочернем процессе (bench_isolated), генератор случайных
+    чисел детерминирован, так что повторный запуск выполняет ровно ту же последовательность операций.
+    Результат -- по строке JSON на замер. */
+
+#define PAIRS_OPS 1000000
+#define MIX_SLOTS 1024
+#define MIX_OPS 1000000
+#define MIX_MIN_SIZE 16
+#define MIX_MAX_SIZE 4096
+#define ORDER_BLOCKS 1000
+#define ORDER_ROUNDS 200
+#define ORDER_SIZE 64
+#define SCALING_SIZE 32
+/*  поиск первого подходящего блока линеен по длине списка, поэтому число замеряемых операций
+    уменьшается с ростом кучи так, чтобы каждый шаг занимал примерно одинаковое время.
+    Само построение кучи квадратично, кучи больше SCALING_DEFAULT_MAX блоков включаются ключом -l */
+#define SCALING_BUDGET 100000000
+#define SCALING_MIN_OPS 1000
+#define SCALING_DEFAULT_MAX 10000
+#define REALLOC_ROUNDS 100
+#define REALLOC_LINEAR_STEP 64
+#define REALLOC_LINEAR_LIMIT (64 * 1024)
+#define REALLOC_GEOMETRIC_LIMIT (16 * 1024 * 1024)
+
+struct measure {
+  size_t ops;
+  double seconds;
+  size_t mapped;
+};
+
+static uint64_t rng_state;
+
+static uint64_t rng_next( void ) { return bench_random( &rng_state ); }
+
+static void touch( void* p ) { if (p) *(volatile char*) p = 0; }
+
+/*  массивы указателей не берутся у измеряемого аллокатора */
+static void** pointers_new( size_t count ) {
+  void** p = mmap( NULL, count * sizeof( void* ), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if (p == MAP_FAILED) { perror( "mmap" ); exit( 1 ); }
+  return p;
+}
+
+static void pointers_delete( void** p, size_t count ) { munmap( p, count * sizeof( void* ) ); }
+
+static struct measure bench_pairs( const struct allocator* a, size_t size ) {
+  const double start = bench_seconds();
+  for (size_t i = 0; i < PAIRS_OPS; i++) {
+    void* p = a->malloc( size );
+    touch( p );
+    a->free( p );
+  }
+  return (struct measure) { 2 * PAIRS_OPS, bench_seconds() - start, a->mapped_bytes() };
+}
+
+static struct measure bench_mix( const struct allocator* a, size_t unused ) {
+  (void) unused;
+  void** slots = pointers_new( MIX_SLOTS );
+  const double start = bench_seconds();
+  for (size_t i = 0; i < MIX_OPS; i++) {
+    const size_t k = rng_next() % MIX_SLOTS;
+    if (slots[k]) { a->free( slots[k] ); slots[k] = NULL; }
+    else { slots[k] = a->malloc( bench_random_size( &rng_state, MIX_MIN_SIZE, MIX_MAX_SIZE ) ); touch( slots[k] ); }
+  }
+  const double seconds = bench_seconds() - start;
+  const size_t mapped = a->mapped_bytes();
+  for (size_t k = 0; k < MIX_SLOTS; k++) a->free( slots[k] );
+  pointers_delete( slots, MIX_SLOTS );
+  return (struct measure) { MIX_OPS, seconds, mapped };
+}
+
+/*  lifo != 0 -- освобождение в обратном порядке, иначе в порядке выделения */
+static struct measure bench_order( const struct allocator* a, size_t lifo ) {
+  void** blocks = pointers_new( ORDER_BLOCKS );
+  size_t mapped = 0;
+  const double start = bench_seconds();
+  for (size_t r = 0; r < ORDER_ROUNDS; r++) {
+    for (size_t i = 0; i < ORDER_BLOCKS; i++) { blocks[i] = a->malloc( ORDER_SIZE ); touch( blocks[i] ); }
+    if (r == 0) mapped = a->mapped_bytes();
+    for (size_t i = 0; i < ORDER_BLOCKS; i++) a->free( blocks[lifo ? ORDER_BLOCKS - 1 - i : i] );
+  }
+  const double seconds = bench_seconds() - start;
+  pointers_delete( blocks, ORDER_BLOCKS );
+  return (struct measure) { 2 * ORDER_BLOCKS * ORDER_ROUNDS, seconds, mapped };
+}
+
+/*  live блоков живут всё время замера; замеряется замена случайного живого блока новым */
+static struct measure bench_scaling( const struct allocator* a, size_t live ) {
+  void** blocks = pointers_new( live );
+  for (size_t i = 0; i < live; i++) { blocks[i] = a->malloc( SCALING_SIZE ); touch( blocks[i] ); }
+  const size_t ops = SCALING_BUDGET / live > SCALING_MIN_OPS ? SCALING_BUDGET / live : SCALING_MIN_OPS;
+  const double start = bench_seconds();
+  for (size_t i = 0; i < ops; i++) {
+    const size_t k = rng_next() % live;
+    a->free( blocks[k] );
+    blocks[k] = a->malloc( SCALING_SIZE );
+    touch( blocks[k] );
+  }
+  const double seconds = bench_seconds() - start;
+  const size_t mapped = a->mapped_bytes();
+  for (size_t i = 0; i < live; i++) a->free( blocks[i] );
+  pointers_delete( blocks, live );
+  return (struct measure) { 2 * ops, seconds, mapped };
+}
+
+/*  geometric != 0 -- размер удваивается до REALLOC_GEOMETRIC_LIMIT, иначе растёт на REALLOC_LINEAR_STEP */
+static struct measure bench_realloc( const struct allocator* a, size_t geometric ) {
+  const size_t limit = geometric ? REALLOC_GEOMETRIC_LIMIT : REALLOC_LINEAR_LIMIT;
+  size_t ops = 0, mapped = 0;
+  const double start = bench_seconds();
+  for (size_t r = 0; r < REALLOC_ROUNDS; r++) {
+    char* p = NULL;
+    for (size_t size = 16; size <= limit; size = geometric ? size * 2 : size + REALLOC_LINEAR_STEP, ops++) {
+      p = a->realloc( p, size );
+      if (!p) break;
+      p[size - 1] = 0;
+    }
+    if (r == 0) mapped = a->mapped_bytes();
+    a->free( p );
+    ops++;
+  }
+  return (struct measure) { ops, bench_seconds() - start, mapped };
+}
+
+#define PARAMS_MAX 8
+
+/*  каждый бенчмарк запускается для всех своих параметров; у scaling параметры дополнительно
+    ограничены ключом -l, потому что большие кучи строятся долго */
+struct benchmark {
+  const char* name;
+  struct measure (*run)( const struct allocator* a, size_t param );
+  const char* param_name;
+  size_t      params[PARAMS_MAX];
+  size_t      params_count;
+  bool        limited_by_max_live;
+};
+
+static const struct benchmark benchmarks[] = {
+  { "pairs",   bench_pairs,   "size",        { 16, 64, 256, 1024, 4096, 16384, 65536 }, 7, false },
+  { "mix",     bench_mix,     NULL,          { 0 },                                     1, false },
+  { "order",   bench_order,   "lifo",        { 0, 1 },                                  2, false },
+  { "scaling", bench_scaling, "live_blocks", { 1000, 10000, 100000, 1000000, 10000000 }, 5, true },
+  { "realloc", bench_realloc, "geometric",   { 0, 1 },                                  2, false },
+};
+
+#define BENCHMARKS_COUNT (sizeof( benchmarks ) / sizeof( benchmarks[0] ))
+
+struct run {
+  const struct benchmark* benchmark;
+  const struct allocator* allocator;
+  size_t                  param;
+};
+
+static void run_one( void* arg ) {
+  struct run const* r = arg;
+  rng_state = 42;
+  const struct measure m = r->benchmark->run( r->allocator, r->param );
+  printf( "{\"benchmark\": \"%s\", \"allocator\": \"%s\"", r->benchmark->name, r->allocator->name );
+  if (r->benchmark->param_name) printf( ", \"%s\": %zu", r->benchmark->param_name, r->param );
+  printf( ", \"ops\": %zu, \"seconds\": %.6f, \"ns_per_op\": %.2f, \"mapped_bytes\": %zu}\n",
+          m.ops, m.seconds, m.ops ? m.seconds * 1e9 / (double) m.ops : 0.0, m.mapped );
+}
+
+static bool run_isolated( const struct benchmark* b, const struct allocator* a, size_t param ) {
+  struct run r = { b, a, param };
+  if (bench_isolated( run_one, &r )) return true;
+  fprintf( stderr, "%s/%s(%zu) failed\n", b->name, a->name, param );
+  return false;
+}
+
+static bool run_benchmark( const struct benchmark* b, const struct allocator* a, size_t max_live ) {
+  bool ok = true;
+  for (size_t i = 0; i < b->params_count; i++)
+    if (!b->limited_by_max_live || b->params[i] <= max_live) ok = run_isolated( b, a, b->params[i] ) && ok;
+  return ok;
+}
+
+static void usage( const char* self ) {
+  fprintf( stderr, "usage: %s [-a mem|tcache|glibc]... [-l max_live_blocks] [pairs|mix|order|scaling|realloc]...\n", self );
+}
+
+/*  по умолчанию -- все бенчмарки на обоих аллокаторах, scaling до SCALING_DEFAULT_MAX живых блоков */
+int main( int argc, char** argv ) {
+  const struct allocator* allocators[3];
+  size_t allocators_count = 0;
+  size_t max_live = SCALING_DEFAULT_MAX;
+  int opt;
+  while ((opt = getopt( argc, argv, "a:l:" )) != -1) {
+    switch (opt) {
+      case 'a':
+        if (allocators_count == 3 || !(allocators[allocators_count++] = allocator_find( optarg ))) {
+          usage( argv[0] );
+          return 2;
+        }
+        break;
+      case 'l': max_live = strtoull( optarg, NULL, 0 ); break;
+      default: usage( argv[0] ); return 2;
+    }
+  }
+  if (allocators_count == 0) {
+    allocators[allocators_count++] = &allocator_mem;
+    allocators[allocators_count++] = &allocator_glibc;
+  }
+
+  bool selected[BENCHMARKS_COUNT] = {0};
+  bool any_selected = false;
+  for (int i = optind; i < argc; i++) {
+    size_t b = 0;
+    while (b < BENCHMARKS_COUNT && strcmp( benchmarks[b].name, argv[i] ) != 0) b++;
+    if (b == BENCHMARKS_COUNT) { usage( argv[0] ); return 2; }
+    selected[b] = any_selected = true;
+  }
+
+  bool ok = true;
+  for (size_t b = 0; b < BENCHMARKS_COUNT; b++) {
+    if (any_selected && !selected[b]) continue;
+    for (size_t i = 0; i < allocators_count; i++) ok = run_benchmark( &benchmarks[b], allocators[i], max_live ) && ok;
+  }
+  return ok ? 0 : 1;
+}
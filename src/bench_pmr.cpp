@@ -0,0 +1,140 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#include "bench.h"
+#include "mem_pmr.hpp"
+
+/*  Контейнеры std на этой куче против стандартного источника памяти (new/delete, то есть glibc).
+    Источники: default -- std::pmr::new_delete_resource, mem -- mem::heap_resource, оба через
+    контейнеры std::pmr; mem_allocator -- обычные контейнеры std с mem::allocator.
+    Каждый замер -- в отдельном процессе, результат -- строка JSON в формате bench_micro.
+    На куче с поиском первого подходящего блока операция стоит O(живых элементов), поэтому
+    число повторов убывает как 1/n^2 и одинаково для всех источников; n меняется ключом -n. */
+
+#define DEFAULT_ELEMENTS 2000
+#define WORK_BUDGET 100000000
+
+namespace {
+
+enum class source { pmr_default, pmr_mem, std_mem };
+
+struct job {
+  const char* benchmark;
+  source      from;
+  std::size_t elements;
+};
+
+const char* source_name( source s ) {
+  switch (s) {
+    case source::pmr_default: return "default";
+    case source::pmr_mem: return "mem";
+    case source::std_mem: return "mem_allocator";
+  }
+  return "?";
+}
+
+/*  заполнить вектор по одному элементу, без reserve: проверяется рост через перевыделение */
+template <class Vector, class... Args>
+std::size_t run_vector( std::size_t n, Args&&... args ) {
+  Vector v( args... );
+  for (std::size_t i = 0; i < n; i++) v.push_back( static_cast<int>( i ) );
+  return n + (v.back() == static_cast<int>( n - 1 ) ? 0 : 1);
+}
+
+/*  вставка n ключей, удаление каждого второго и повторная вставка */
+template <class Map, class... Args>
+std::size_t run_map( std::size_t n, Args&&... args ) {
+  Map m( args... );
+  for (std::size_t i = 0; i < n; i++) m.emplace( static_cast<int>( i ), static_cast<int>( i ) );
+  for (std::size_t i = 0; i < n; i += 2) m.erase( static_cast<int>( i ) );
+  for (std::size_t i = 0; i < n; i += 2) m.emplace( static_cast<int>( i ), 0 );
+  return 2 * n;
+}
+
+/*  очередь: на каждую вставку в хвост после заполнения приходится удаление из головы */
+template <class List, class... Args>
+std::size_t run_list( std::size_t n, Args&&... args ) {
+  List l( args... );
+  for (std::size_t i = 0; i < n; i++) l.push_back( static_cast<int>( i ) );
+  for (std::size_t i = 0; i < n; i++) {
+    l.pop_front();
+    l.push_back( static_cast<int>( i ) );
+  }
+  return 2 * n;
+}
+
+template <template <class> class Allocator>
+using std_map = std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Allocator<std::pair<const int, int>>>;
+
+std::size_t run_once( job const& j, std::pmr::memory_resource* resource ) {
+  const bool pmr = j.from != source::std_mem;
+  if (std::strcmp( j.benchmark, "vector" ) == 0)
+    return pmr ? run_vector<std::pmr::vector<int>>( j.elements, resource )
+               : run_vector<std::vector<int, mem::allocator<int>>>( j.elements );
+  if (std::strcmp( j.benchmark, "unordered_map" ) == 0)
+    return pmr ? run_map<std::pmr::unordered_map<int, int>>( j.elements, resource )
+               : run_map<std_map<mem::allocator>>( j.elements );
+  return pmr ? run_list<std::pmr::list<int>>( j.elements, resource )
+             : run_list<std::list<int, mem::allocator<int>>>( j.elements );
+}
+
+void run_job( void* arg ) {
+  job const& j = *static_cast<job const*>( arg );
+  std::pmr::memory_resource* resource =
+    j.from == source::pmr_default ? std::pmr::new_delete_resource() : mem::main_heap_resource();
+  const struct allocator* counted = j.from == source::pmr_default ? &allocator_glibc : &allocator_mem;
+
+  const std::size_t rounds = WORK_BUDGET / j.elements / j.elements ? WORK_BUDGET / j.elements / j.elements : 1;
+  std::size_t ops = 0;
+  const double start = bench_seconds();
+  for (std::size_t r = 0; r < rounds; r++) ops += run_once( j, resource );
+  const double seconds = bench_seconds() - start;
+  std::printf( "{\"benchmark\": \"pmr_%s\", \"allocator\": \"%s\", \"elements\": %zu, \"ops\": %zu, "
+               "\"seconds\": %.6f, \"ns_per_op\": %.2f, \"mapped_bytes\": %zu}\n",
+               j.benchmark, source_name( j.from ), j.elements, ops, seconds, seconds * 1e9 / (double) ops,
+               counted->mapped_bytes() );
+  std::fflush( stdout );
+}
+
+void usage( const char* self ) {
+  std::fprintf( stderr, "usage: %s [-n elements] [vector|unordered_map|list]...\n", self );
+}
+
+}  // namespace
+
+/*  по умолчанию -- все контейнеры на всех источниках */
+int main( int argc, char** argv ) {
+  std::size_t elements = DEFAULT_ELEMENTS;
+  int opt;
+  while ((opt = getopt( argc, argv, "n:" )) != -1) {
+    if (opt != 'n') { usage( argv[0] ); return 2; }
+    elements = std::strtoull( optarg, nullptr, 0 );
+  }
+  if (elements == 0) { usage( argv[0] ); return 2; }
+
+  const char* all[] = { "vector", "unordered_map", "list" };
+  const char* const* benchmarks = optind < argc ? argv + optind : all;
+  const std::size_t count = optind < argc ? static_cast<std::size_t>( argc - optind ) : 3;
+  for (std::size_t b = 0; b < count; b++) {
+    bool known = false;
+    for (const char* name : all) known = known || std::strcmp( name, benchmarks[b] ) == 0;
+    if (!known) { usage( argv[0] ); return 2; }
+  }
+
+  bool ok = true;
+  for (std::size_t b = 0; b < count; b++)
+    for (source from : { source::pmr_default, source::pmr_mem, source::std_mem }) {
+      job j = { benchmarks[b], from, elements };
+      if (!bench_isolated( run_job, &j )) {
+        std::fprintf( stderr, "pmr_%s/%s failed\n", benchmarks[b], source_name( from ) );
+        ok = false;
+      }
+    }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+#define _DEFAULT_SOURCE
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "bench.h"
+#include "latency.h"
+#include "trace.h"
+
+/*  Воспроизведение трассы (trace.h) на выбранном аллокаторе.
+    Записи разных потоков сначала сливаются по timestamp (trace_file_sort), каждый аллокатор
+    воспроизводит трассу в отдельном процессе (bench_isolated).
+    Указатели из трассы отображаются на настоящие через хэш-таблицу с открытой адресацией;
+    таблица и сама трасса живут в отдельных отображениях, чтобы не мешать измеряемому аллокатору.
+    Записи, которые не воспроизводятся (освобождение блока, выделенного до начала трассы,
+    неудавшиеся в трассе вызовы), в ops и гистограмму задержек не входят. */
+
+#define SAMPLE_EVERY 4096
+#define RELEASE_TRACE_EVERY (1 << 20)
+
+struct pointer_slot {
+  uint64_t traced;
+  void*    live;
+  size_t   size;
+};
+
+#define SLOT_EMPTY 0
+#define SLOT_DELETED 1
+
+struct pointer_map {
+  struct pointer_slot* slots;
+  size_t               mask;
+};
+
+static size_t hash_pointer( uint64_t p ) { return (size_t) ((p >> 4) * 0x9E3779B97F4A7C15ull); }
+
+static bool map_create( struct pointer_map* m, size_t records ) {
+  size_t capacity = 1024;
+  while (capacity < 2 * records) capacity <<= 1;
+  m->slots = mmap( NULL, capacity * sizeof( struct pointer_slot ), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+  m->mask = capacity - 1;
+  return m->slots != MAP_FAILED;
+}
+
+static void map_destroy( struct pointer_map* m ) { munmap( m->slots, (m->mask + 1) * sizeof( struct pointer_slot ) ); }
+
+static void map_put( struct pointer_map* m, uint64_t traced, void* live, size_t size ) {
+  for (size_t i = hash_pointer( traced ) & m->mask;; i = (i + 1) & m->mask)
+    if (m->slots[i].traced <= SLOT_DELETED || m->slots[i].traced == traced) {
+      m->slots[i] = (struct pointer_slot) { traced, live, size };
+      return;
+    }
+}
+
+/*  найти и удалить запись; false, если указатель был выделен до начала трассы */
+static bool map_take( struct pointer_map* m, uint64_t traced, struct pointer_slot* out ) {
+  for (size_t i = hash_pointer( traced ) & m->mask; m->slots[i].traced != SLOT_EMPTY; i = (i + 1) & m->mask)
+    if (m->slots[i].traced == traced) {
+      *out = m->slots[i];
+      m->slots[i].traced = SLOT_DELETED;
+      return true;
+    }
+  return false;
+}
+
+struct replay_result {
+  size_t   ops;
+  double   seconds;
+  size_t   peak_live, peak_mapped, peak_rss, final_mapped;
+  struct latency_histogram latency;
+};
+
+static void sample( struct replay_result* r, const struct allocator* a, size_t rss_base ) {
+  const size_t mapped = a->mapped_bytes();
+  const size_t rss = bench_rss_bytes();
+  if (mapped > r->peak_mapped) r->peak_mapped = mapped;
+  if (rss > rss_base && rss - rss_base > r->peak_rss) r->peak_rss = rss - rss_base;
+}
+
+/*  прочитанная часть трассы больше не нужна: отдаём её страницы, чтобы они не попадали в RSS */
+static void release_consumed( struct trace_file const* t, struct trace_record const* upto ) {
+  const size_t consumed = ((uint8_t const*) upto - t->base) & ~((size_t) getpagesize() - 1);
+  if (consumed) madvise( t->base, consumed, MADV_DONTNEED );
+}
+
+static void replay( const struct allocator* a, struct trace_file const* t, struct replay_result* r ) {
+  struct trace_record const* records = t->records;
+  const size_t count = t->count;
+  struct pointer_map map;
+  if (!map_create( &map, count )) return;
+  /*  страницы таблицы загружаются заранее, чтобы не попасть в прирост RSS измеряемого аллокатора */
+  memset( map.slots, 0, (map.mask + 1) * sizeof( struct pointer_slot ) );
+  const size_t rss_base = bench_rss_bytes();
+  const size_t mapped_base = a->mapped_bytes();
+  size_t live = 0;
+  const double start = bench_seconds();
+
+  for (size_t i = 0; i < count; i++) {
+    struct trace_record const* rec = &records[i];
+    struct pointer_slot old = {0};
+    uint64_t op_start;
+    /*  задержка -- только вызов аллокатора, без поиска и вставки в таблицу указателей */
+    uint64_t duration;
+    switch (rec->op) {
+      case TRACE_MALLOC: {
+        /*  неудавшийся в трассе malloc (ptr 0) не воспроизводится: 0 -- ключ пустой ячейки */
+        if (!rec->ptr) continue;
+        op_start = latency_now();
+        void* p = a->malloc( rec->size );
+        duration = latency_now() - op_start;
+        if (p && rec->size) *(volatile char*) p = 0;
+        if (p) { map_put( &map, rec->ptr, p, rec->size ); live += rec->size; }
+        break;
+      }
+      case TRACE_FREE:
+        if (!map_take( &map, rec->ptr, &old )) continue;
+        op_start = latency_now();
+        a->free( old.live );
+        duration = latency_now() - op_start;
+        live -= old.size;
+        break;
+      case TRACE_REALLOC: {
+        /*  неудавшийся realloc оставил старый блок на месте */
+        if (!rec->ptr && rec->size) continue;
+        if (rec->old_ptr && !map_take( &map, rec->old_ptr, &old )) continue;
+        op_start = latency_now();
+        void* p = a->realloc( old.live, rec->size );
+        duration = latency_now() - op_start;
+        live -= old.size;
+        if (p && rec->ptr) { map_put( &map, rec->ptr, p, rec->size ); live += rec->size; }
+        else if (p) a->free( p );
+        break;
+      }
+      default:
+        continue;
+    }
+    latency_histogram_record( &r->latency, duration );
+    r->ops++;
+    if (live > r->peak_live) r->peak_live = live;
+    if (i % SAMPLE_EVERY == 0) sample( r, a, rss_base );
+    if (i % RELEASE_TRACE_EVERY == RELEASE_TRACE_EVERY - 1) release_consumed( t, rec );
+  }
+  r->seconds = bench_seconds() - start;
+  sample( r, a, rss_base );
+  const size_t final_mapped = a->mapped_bytes();
+  r->final_mapped = final_mapped > mapped_base ? final_mapped - mapped_base : 0;
+  r->peak_mapped = r->peak_mapped > mapped_base ? r->peak_mapped - mapped_base : 0;
+
+  for (size_t i = 0; i <= map.mask; i++)
+    if (map.slots[i].traced > SLOT_DELETED) a->free( map.slots[i].live );
+  map_destroy( &map );
+}
+
+static void print_result( const struct allocator* a, struct replay_result const* r ) {
+  printf( "{\"allocator\": \"%s\", \"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+          "\"peak_live_bytes\": %zu, \"peak_mapped_bytes\": %zu, \"final_mapped_bytes\": %zu, "
+          "\"peak_rss_bytes\": %zu, \"fragmentation\": %.4f, \"latency_unit\": \"%s\", "
+          "\"latency\": {\"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64 ", "
+          "\"p999\": %" PRIu64 ", \"max\": %" PRIu64 "}}\n",
+          a->name, r->ops, r->seconds, r->seconds > 0 ? (double) r->ops / r->seconds : 0.0,
+          r->peak_live, r->peak_mapped, r->final_mapped, r->peak_rss,
+          r->peak_live ? (double) r->peak_mapped / (double) r->peak_live : 0.0, latency_unit(),
+          latency_histogram_percentile( &r->latency, 50 ), latency_histogram_percentile( &r->latency, 90 ),
+          latency_histogram_percentile( &r->latency, 99 ), latency_histogram_percentile( &r->latency, 99.9 ),
+          (uint64_t) r->latency.max );
+}
+
+struct replay_job {
+  const struct allocator*  allocator;
+  struct trace_file const* trace;
+};
+
+static void run_replay( void* arg ) {
+  struct replay_job const* job = arg;
+  static struct replay_result result;
+  replay( job->allocator, job->trace, &result );
+  print_result( job->allocator, &result );
+}
+
+/*  bench_replay <трасса> [mem|glibc ...]: по строке JSON на каждый аллокатор (по умолчанию -- оба) */
+int main( int argc, char** argv ) {
+  if (argc < 2) {
+    fprintf( stderr, "usage: %s <trace> [mem|glibc ...]\n", argv[0] );
+    return 2;
+  }
+  struct trace_file t;
+  if (!trace_file_open( argv[1], &t )) {
+    fprintf( stderr, "%s: not a readable allocation trace\n", argv[1] );
+    return 1;
+  }
+  if (!trace_file_sort( &t )) {
+    fprintf( stderr, "%s: not enough memory to order the trace\n", argv[1] );
+    return 1;
+  }
+
+  const char* defaults[] = { "mem", "glibc" };
+  const char** names = argc > 2 ? (const char**) argv + 2 : defaults;
+  const size_t count = argc > 2 ? (size_t) argc - 2 : 2;
+  for (size_t i = 0; i < count; i++)
+    if (!allocator_find( names[i] )) {
+      fprintf( stderr, "unknown allocator %s\n", names[i] );
+      return 2;
+    }
+  bool ok = true;
+  for (size_t i = 0; i < count; i++) {
+    struct replay_job job = { allocator_find( names[i] ), &t };
+    if (!bench_isolated( run_replay, &job )) {
+      fprintf( stderr, "%s failed\n", names[i] );
+      ok = false;
+    }
+  }
+  trace_file_close( &t );
+  return ok ? 0 : 1;
+}
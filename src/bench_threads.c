@@ -0,0 +1,338 @@
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "bench.h"
+#include "slab.h"
+
+/*  Многопоточные бенчмарки в духе классических наборов:
+      larson        -- "сервер": потоки заменяют случайные блоки в массиве, а массивы переходят от потока
+                       к потоку, так что блоки освобождает не тот поток, который их выделил;
+      threadtest    -- каждый поток выделяет пачку блоков и тут же освобождает её, ничего не делясь;
+      xmalloc       -- производитель и потребитель: блоки, выделенные потоком, освобождает следующий;
+      cache-scratch -- пассивное ложное разделение: мелкий объект постоянно перевыделяется и пишется,
+                       и если соседние объекты достались разным потокам, они делят строку кэша.
+    Каждый замер длится фиксированное время и идёт в отдельном процессе (bench_isolated);
+    результат -- строка JSON с числом операций в секунду на поток.
+    Кроме аллокаторов из bench.h здесь есть "slab" -- слабы без блокировок (slab.h): все бенчмарки
+    просят не больше SLAB_MAX_OBJECT байт и не зовут realloc. */
+
+#define DEFAULT_SECONDS 0.5
+#define THREADS_MAX 256
+
+#define LARSON_SLOTS 1000
+#define LARSON_ROUND 1000
+#define LARSON_MIN_SIZE 16
+#define LARSON_MAX_SIZE 256
+#define THREADTEST_BATCH 1000
+#define THREADTEST_SIZE 64
+#define XMALLOC_RING 4096
+#define XMALLOC_BURST 64
+#define XMALLOC_MIN_SIZE 16
+#define XMALLOC_MAX_SIZE 512
+#define SCRATCH_SIZE 8
+#define SCRATCH_WRITES 100
+
+#define CACHE_LINE 64
+
+struct worker {
+  _Alignas( CACHE_LINE ) pthread_t thread;
+  size_t                  index;
+  uint64_t                rng;
+  size_t                  ops;
+  struct bench_run const* run;
+};
+
+struct bench_run {
+  const struct allocator* allocator;
+  size_t                  threads;
+  double                  seconds;
+  _Atomic bool            stop;
+  struct worker*          workers;
+  void*                   shared;
+};
+
+struct benchmark {
+  const char* name;
+  void  (*setup)( struct bench_run* r );
+  void* (*work)( void* worker );
+  void  (*teardown)( struct bench_run* r );
+};
+
+/*  --- слабы как аллокатор: по кэшу на степень двойки от SLAB_MIN_OBJECT до SLAB_MAX_OBJECT --- */
+
+#define SLAB_CLASSES 7
+
+static struct slab_cache slab_caches[SLAB_CLASSES];
+
+static void* slab_malloc( size_t size ) {
+  size_t c = 0;
+  while (c < SLAB_CLASSES && ((size_t) SLAB_MIN_OBJECT << c) < size) c++;
+  return c < SLAB_CLASSES ? slab_alloc( &slab_caches[c] ) : NULL;
+}
+
+/*  страницы слабов в статистику кучи не входят */
+static size_t slab_mapped_bytes( void ) { return 0; }
+
+static const struct allocator allocator_slab = { "slab", slab_malloc, slab_free, NULL, slab_mapped_bytes };
+
+static const struct allocator* find_allocator( const char* name ) {
+  return strcmp( name, allocator_slab.name ) == 0 ? &allocator_slab : allocator_find( name );
+}
+
+/*  служебные структуры бенчмарков не берутся у измеряемого аллокатора */
+static void* scratch_new( size_t size ) {
+  void* p = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if (p == MAP_FAILED) { perror( "mmap" ); exit( 1 ); }
+  return p;
+}
+
+static bool stopped( struct bench_run const* r ) { return atomic_load_explicit( &r->stop, memory_order_relaxed ); }
+
+/*  --- larson --- */
+
+/*  массивов на один больше, чем потоков: поток кладёт свой массив в общий ящик и забирает оттуда чужой */
+struct larson {
+  void**           arrays;
+  _Atomic(void**)  mailbox;
+};
+
+static void larson_setup( struct bench_run* r ) {
+  struct larson* l = scratch_new( sizeof( *l ) );
+  l->arrays = scratch_new( (r->threads + 1) * LARSON_SLOTS * sizeof( void* ) );
+  uint64_t rng = 7;
+  for (size_t i = 0; i < (r->threads + 1) * LARSON_SLOTS; i++)
+    l->arrays[i] = r->allocator->malloc( bench_random_size( &rng, LARSON_MIN_SIZE, LARSON_MAX_SIZE ) );
+  atomic_init( &l->mailbox, l->arrays + r->threads * LARSON_SLOTS );
+  r->shared = l;
+}
+
+static void* larson_work( void* arg ) {
+  struct worker* w = arg;
+  struct larson* l = w->run->shared;
+  const struct allocator* a = w->run->allocator;
+  void** slots = l->arrays + w->index * LARSON_SLOTS;
+  while (!stopped( w->run )) {
+    for (size_t i = 0; i < LARSON_ROUND; i++) {
+      const size_t k = bench_random( &w->rng ) % LARSON_SLOTS;
+      a->free( slots[k] );
+      slots[k] = a->malloc( bench_random_size( &w->rng, LARSON_MIN_SIZE, LARSON_MAX_SIZE ) );
+    }
+    w->ops += 2 * LARSON_ROUND;
+    slots = atomic_exchange( &l->mailbox, slots );
+  }
+  return NULL;
+}
+
+static void larson_teardown( struct bench_run* r ) {
+  struct larson* l = r->shared;
+  for (size_t i = 0; i < (r->threads + 1) * LARSON_SLOTS; i++) r->allocator->free( l->arrays[i] );
+}
+
+/*  --- threadtest --- */
+
+static void* threadtest_work( void* arg ) {
+  struct worker* w = arg;
+  const struct allocator* a = w->run->allocator;
+  void** batch = scratch_new( THREADTEST_BATCH * sizeof( void* ) );
+  while (!stopped( w->run )) {
+    for (size_t i = 0; i < THREADTEST_BATCH; i++) batch[i] = a->malloc( THREADTEST_SIZE );
+    for (size_t i = 0; i < THREADTEST_BATCH; i++) a->free( batch[i] );
+    w->ops += 2 * THREADTEST_BATCH;
+  }
+  munmap( batch, THREADTEST_BATCH * sizeof( void* ) );
+  return NULL;
+}
+
+/*  --- xmalloc --- */
+
+/*  кольцо с одним производителем (поток i - 1) и одним потребителем (поток i) */
+struct ring {
+  _Alignas( CACHE_LINE ) _Atomic size_t head;
+  _Alignas( CACHE_LINE ) _Atomic size_t tail;
+  void* slots[XMALLOC_RING];
+};
+
+static void xmalloc_setup( struct bench_run* r ) { r->shared = scratch_new( r->threads * sizeof( struct ring ) ); }
+
+static void* xmalloc_work( void* arg ) {
+  struct worker* w = arg;
+  struct ring* rings = w->run->shared;
+  struct ring* out = &rings[(w->index + 1) % w->run->threads];
+  struct ring* in = &rings[w->index];
+  const struct allocator* a = w->run->allocator;
+  while (!stopped( w->run )) {
+    const size_t head = atomic_load_explicit( &out->head, memory_order_relaxed );
+    const size_t tail = atomic_load_explicit( &out->tail, memory_order_acquire );
+    size_t produced = 0;
+    for (; produced < XMALLOC_BURST && head + produced - tail < XMALLOC_RING; produced++)
+      out->slots[(head + produced) % XMALLOC_RING] =
+        a->malloc( bench_random_size( &w->rng, XMALLOC_MIN_SIZE, XMALLOC_MAX_SIZE ) );
+    atomic_store_explicit( &out->head, head + produced, memory_order_release );
+
+    const size_t in_tail = atomic_load_explicit( &in->tail, memory_order_relaxed );
+    const size_t in_head = atomic_load_explicit( &in->head, memory_order_acquire );
+    size_t consumed = 0;
+    for (; consumed < XMALLOC_BURST && in_tail + consumed < in_head; consumed++)
+      a->free( in->slots[(in_tail + consumed) % XMALLOC_RING] );
+    atomic_store_explicit( &in->tail, in_tail + consumed, memory_order_release );
+    w->ops += produced + consumed;
+  }
+  return NULL;
+}
+
+static void xmalloc_teardown( struct bench_run* r ) {
+  struct ring* rings = r->shared;
+  for (size_t i = 0; i < r->threads; i++)
+    for (size_t t = rings[i].tail; t < rings[i].head; t++) r->allocator->free( rings[i].slots[t % XMALLOC_RING] );
+}
+
+/*  --- cache-scratch --- */
+
+/*  главный поток выделяет по объекту на каждый поток подряд, так что они почти наверняка делят строку кэша;
+    поток освобождает полученный объект и дальше работает со своими */
+static void scratch_setup( struct bench_run* r ) {
+  void** objects = scratch_new( r->threads * sizeof( void* ) );
+  for (size_t i = 0; i < r->threads; i++) objects[i] = r->allocator->malloc( SCRATCH_SIZE );
+  r->shared = objects;
+}
+
+static void* scratch_work( void* arg ) {
+  struct worker* w = arg;
+  const struct allocator* a = w->run->allocator;
+  a->free( ((void**) w->run->shared)[w->index] );
+  while (!stopped( w->run )) {
+    volatile char* p = a->malloc( SCRATCH_SIZE );
+    for (size_t i = 0; i < SCRATCH_WRITES; i++) p[i % SCRATCH_SIZE]++;
+    a->free( (void*) p );
+    w->ops += 2;
+  }
+  return NULL;
+}
+
+static const struct benchmark benchmarks[] = {
+  { "larson",        larson_setup,  larson_work,     larson_teardown },
+  { "threadtest",    NULL,          threadtest_work, NULL },
+  { "xmalloc",       xmalloc_setup, xmalloc_work,    xmalloc_teardown },
+  { "cache-scratch", scratch_setup, scratch_work,    NULL },
+};
+
+#define BENCHMARKS_COUNT (sizeof( benchmarks ) / sizeof( benchmarks[0] ))
+
+struct job {
+  const struct benchmark* benchmark;
+  const struct allocator* allocator;
+  size_t                  threads;
+  double                  seconds;
+};
+
+static void run_job( void* arg ) {
+  struct job const* job = arg;
+  struct bench_run* r = scratch_new( sizeof( *r ) );
+  r->allocator = job->allocator;
+  r->threads = job->threads;
+  r->seconds = job->seconds;
+  r->workers = scratch_new( job->threads * sizeof( struct worker ) );
+  if (job->benchmark->setup) job->benchmark->setup( r );
+
+  const double start = bench_seconds();
+  for (size_t i = 0; i < r->threads; i++) {
+    r->workers[i] = (struct worker) { .index = i, .rng = 0x9E3779B97F4A7C15ull * (i + 1), .run = r };
+    if (pthread_create( &r->workers[i].thread, NULL, job->benchmark->work, &r->workers[i] ) != 0) {
+      perror( "pthread_create" );
+      exit( 1 );
+    }
+  }
+  usleep( (useconds_t) (r->seconds * 1e6) );
+  atomic_store( &r->stop, true );
+  size_t ops = 0;
+  for (size_t i = 0; i < r->threads; i++) {
+    pthread_join( r->workers[i].thread, NULL );
+    ops += r->workers[i].ops;
+  }
+  const double seconds = bench_seconds() - start;
+  if (job->benchmark->teardown) job->benchmark->teardown( r );
+
+  const double per_second = (double) ops / seconds;
+  printf( "{\"benchmark\": \"%s\", \"allocator\": \"%s\", \"threads\": %zu, \"ops\": %zu, \"seconds\": %.6f, "
+          "\"ops_per_sec\": %.0f, \"ops_per_sec_per_thread\": %.0f, \"mapped_bytes\": %zu}\n",
+          job->benchmark->name, job->allocator->name, job->threads, ops, seconds,
+          per_second, per_second / (double) job->threads, job->allocator->mapped_bytes() );
+}
+
+static void usage( const char* self ) {
+  fprintf( stderr, "usage: %s [-a mem|tcache|glibc|slab]... [-t threads,...] [-s seconds] "
+                   "[larson|threadtest|xmalloc|cache-scratch]...\n", self );
+}
+
+/*  по умолчанию -- все бенчмарки на всех аллокаторах для 1, 2, 4, ... потоков до числа процессоров */
+int main( int argc, char** argv ) {
+  const struct allocator* allocators[4];
+  size_t allocators_count = 0;
+  size_t threads[32];
+  size_t threads_count = 0;
+  double seconds = DEFAULT_SECONDS;
+  int opt;
+  while ((opt = getopt( argc, argv, "a:t:s:" )) != -1) {
+    switch (opt) {
+      case 'a':
+        if (allocators_count == 4 || !(allocators[allocators_count++] = find_allocator( optarg ))) {
+          usage( argv[0] );
+          return 2;
+        }
+        break;
+      case 't':
+        for (char* p = optarg; *p && threads_count < sizeof( threads ) / sizeof( threads[0] ); p += *p == ',') {
+          threads[threads_count] = strtoull( p, &p, 10 );
+          if (threads[threads_count] == 0 || threads[threads_count] > THREADS_MAX || (*p && *p != ',')) {
+            usage( argv[0] );
+            return 2;
+          }
+          threads_count++;
+        }
+        break;
+      case 's': seconds = strtod( optarg, NULL ); break;
+      default: usage( argv[0] ); return 2;
+    }
+  }
+  if (allocators_count == 0) {
+    allocators[allocators_count++] = &allocator_mem;
+    allocators[allocators_count++] = &allocator_tcache;
+    allocators[allocators_count++] = &allocator_glibc;
+    allocators[allocators_count++] = &allocator_slab;
+  }
+  for (size_t c = 0; c < SLAB_CLASSES; c++) slab_cache_init( &slab_caches[c], (size_t) SLAB_MIN_OBJECT << c );
+  if (threads_count == 0) {
+    const long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+    for (size_t t = 1; t <= (size_t) (cpus > 0 ? cpus : 1) && t <= THREADS_MAX; t *= 2) threads[threads_count++] = t;
+  }
+
+  bool selected[BENCHMARKS_COUNT] = {0};
+  bool any_selected = false;
+  for (int i = optind; i < argc; i++) {
+    size_t b = 0;
+    while (b < BENCHMARKS_COUNT && strcmp( benchmarks[b].name, argv[i] ) != 0) b++;
+    if (b == BENCHMARKS_COUNT) { usage( argv[0] ); return 2; }
+    selected[b] = any_selected = true;
+  }
+
+  bool ok = true;
+  for (size_t b = 0; b < BENCHMARKS_COUNT; b++) {
+    if (any_selected && !selected[b]) continue;
+    for (size_t i = 0; i < allocators_count; i++)
+      for (size_t t = 0; t < threads_count; t++) {
+        struct job job = { &benchmarks[b], allocators[i], threads[t], seconds };
+        if (!bench_isolated( run_job, &job )) {
+          fprintf( stderr, "%s/%s with %zu threads failed\n", benchmarks[b].name, allocators[i]->name, threads[t] );
+          ok = false;
+        }
+      }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+#define _DEFAULT_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mem_internals.h"
+
+struct mem_config mem_config = {
+  .initial_size = REGION_MIN_SIZE,
+  .heap_start = HEAP_START,
+  .region_min_size = REGION_MIN_SIZE,
+  .growth_factor = 1,
+  .split_threshold = BLOCK_MIN_CAPACITY,
+  .cache_size = MAGAZINE_SIZE,
+  .size_classes = { 16, 32, 64, 128, 256, 512, 1024, TCACHE_MAX_SIZE },
+  .size_class_count = TCACHE_CLASSES,
+#ifdef DEBUG
+  .debug = true,
+#endif
+};
+
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+
+static const struct { const char* key; int param; } config_keys[] = {
+  { "heap_size",       MEM_OPT_HEAP_SIZE },
+  { "heap_start",      MEM_OPT_HEAP_START },
+  { "prefault",        MEM_OPT_PREFAULT },
+  { "region_min",      MEM_OPT_REGION_MIN },
+  { "growth_factor",   MEM_OPT_GROWTH_FACTOR },
+  { "mmap_threshold",  MEM_OPT_MMAP_THRESHOLD },
+  { "trim_threshold",  MEM_OPT_TRIM_THRESHOLD },
+  { "split_threshold", MEM_OPT_SPLIT_THRESHOLD },
+  { "cache_size",      MEM_OPT_CACHE_SIZE },
+  { "debug",           MEM_OPT_DEBUG },
+  { "profile_rate",    MEM_OPT_PROFILE_RATE },
+  { "check_interval",  MEM_OPT_CHECK_INTERVAL },
+};
+
+#define CONFIG_KEYS_COUNT (sizeof( config_keys ) / sizeof( config_keys[0] ))
+
+/*  strtoull молча принимает "-1" как ULLONG_MAX, поэтому минус отсекается заранее;
+    переполнение при разборе и при умножении на суффикс тоже считается ошибкой */
+static bool parse_size( const char* value, size_t length, size_t* result ) {
+  const char* digits = value;
+  while (digits < value + length && isspace( (unsigned char) *digits )) digits++;
+  if (digits < value + length && *digits == '-') return false;
+  char* end;
+  errno = 0;
+  unsigned long long parsed = strtoull( value, &end, 0 );
+  if (end == value || errno == ERANGE || parsed > SIZE_MAX) return false;
+  if (end < value + length) {
+    unsigned shift;
+    switch (*end++) {
+      case 'k': case 'K': shift = 10; break;
+      case 'm': case 'M': shift = 20; break;
+      case 'g': case 'G': shift = 30; break;
+      default: return false;
+    }
+    if (parsed > (SIZE_MAX >> shift)) return false;
+    parsed <<= shift;
+  }
+  if (end != value + length) return false;
+  *result = (size_t) parsed;
+  return true;
+}
+
+/*  "16:48:128" -- строго возрастающие размеры, не больше TCACHE_CLASSES штук */
+static bool parse_size_classes( const char* value, size_t length ) {
+  size_t classes[TCACHE_CLASSES];
+  size_t count = 0;
+  const char* const end = value + length;
+  while (value < end) {
+    const char* colon = memchr( value, ':', end - value );
+    const char* item_end = colon ? colon : end;
+    if (count == TCACHE_CLASSES || !parse_size( value, item_end - value, &classes[count] )) return false;
+    if (classes[count] == 0 || (count > 0 && classes[count] <= classes[count - 1])) return false;
+    count++;
+    value = colon ? colon + 1 : end;
+  }
+  if (count == 0) return false;
+  for (size_t i = 0; i < count; i++) mem_config.size_classes[i] = classes[i];
+  mem_config.size_class_count = count;
+  return true;
+}
+
+/*  без mem_config_load: вызывается и при разборе MEM_CONF, уже под config_once */
+static int set_option( int param, size_t value ) {
+  const size_t page = getpagesize();
+  switch (param) {
+    case MEM_OPT_HEAP_SIZE:
+    case MEM_OPT_HEAP_START:
+    case MEM_OPT_PREFAULT:
+      if (heap_is_ready()) return 0;
+      if (param == MEM_OPT_HEAP_SIZE) mem_config.initial_size = value;
+      else if (param == MEM_OPT_HEAP_START) mem_config.heap_start = (void*) (uintptr_t) value;
+      else mem_config.options.prefault = value != 0;
+      break;
+    /*  регион, не кратный странице, сдвинул бы адрес следующего, и MAP_FIXED_NOREPLACE его бы не принял */
+    case MEM_OPT_REGION_MIN:
+      if (value > SIZE_MAX - page) return 0;
+      mem_config.region_min_size = (value + page - 1) / page * page;
+      break;
+    case MEM_OPT_GROWTH_FACTOR:
+      if (value == 0) return 0;
+      mem_config.growth_factor = value;
+      break;
+    case MEM_OPT_MMAP_THRESHOLD:  mem_config.mmap_threshold = value; break;
+    case MEM_OPT_TRIM_THRESHOLD:  mem_config.trim_threshold = value; break;
+    case MEM_OPT_SPLIT_THRESHOLD:
+      if (value < BLOCK_MIN_CAPACITY) return 0;
+      mem_config.split_threshold = value;
+      break;
+    case MEM_OPT_CACHE_SIZE:
+      if (value == 0) return 0;
+      mem_config.cache_size = value;
+      break;
+    case MEM_OPT_DEBUG:           mem_config.debug = value != 0; break;
+    case MEM_OPT_PROFILE_RATE:    mem_config.profile_rate = value; break;
+    case MEM_OPT_CHECK_INTERVAL:  mem_config.check_interval = value; break;
+    default: return 0;
+  }
+  return 1;
+}
+
+static bool apply_option( const char* key, size_t key_length, const char* value, size_t value_length ) {
+  if (key_length == strlen( "size_classes" ) && strncmp( key, "size_classes", key_length ) == 0)
+    return parse_size_classes( value, value_length );
+  size_t parsed;
+  if (!parse_size( value, value_length, &parsed )) return false;
+  for (size_t i = 0; i < CONFIG_KEYS_COUNT; i++)
+    if (strlen( config_keys[i].key ) == key_length && strncmp( config_keys[i].key, key, key_length ) == 0)
+      return set_option( config_keys[i].param, parsed );
+  return false;
+}
+
+bool mem_config_parse( const char* conf ) {
+  bool ok = true;
+  while (*conf) {
+    const size_t length = strcspn( conf, "," );
+    const char* eq = memchr( conf, '=', length );
+    if (eq) ok = apply_option( conf, eq - conf, eq + 1, conf + length - eq - 1 ) && ok;
+    else if (length > 0) ok = false;
+    conf += length;
+    if (*conf == ',') conf++;
+  }
+  return ok;
+}
+
+static void config_load_environment( void ) {
+  const char* conf = getenv( "MEM_CONF" );
+  if (conf) mem_config_parse( conf );
+}
+
+void mem_config_load( void ) { pthread_once( &config_once, config_load_environment ); }
+
+int _mallopt( int param, size_t value ) {
+  mem_config_load();
+  return set_option( param, value );
+}
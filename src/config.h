@@ -0,0 +1,55 @@
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mem.h"
+#include "tcache.h"
+
+/*  Настройки аллокатора. Читаются один раз (под pthread_once) из переменной окружения MEM_CONF
+    вида "ключ=значение,ключ=значение" (размеры можно писать с суффиксами k, m, g), после чего
+    их можно менять через _mallopt. Горячий путь читает готовые поля структуры; поля, которые
+    можно менять на ходу, атомарные. heap_size, heap_start и prefault задают устройство основной
+    кучи и принимаются только до её создания.
+
+      heap_size        начальный размер кучи
+      heap_start       адрес, с которого начинается основная куча
+      prefault         1 -- заранее загружать страницы новых регионов
+      region_min       минимальный размер региона (округляется вверх до страницы)
+      growth_factor    если больше 1, каждый новый регион не меньше предыдущего, умноженного
+                       на этот множитель, но не больше REGION_GROWTH_MAX
+      mmap_threshold   запросы от этого размера получают собственное отображение (0 -- выключено)
+      trim_threshold   свободный хвост кучи от этого размера возвращается ядру (0 -- выключено)
+      split_threshold  минимальная вместимость остатка, ради которой блок делится
+      cache_size       число объектов в магазине кэша потока
+      profile_rate     средний интервал в байтах между выборками профиля кучи (0 -- профиль выключен)
+      check_interval   раз в столько операций с кучей проверять её очередной регион (0 -- выключено)
+      size_classes     размерные классы кэша потока по возрастанию через ':' (до TCACHE_CLASSES штук)
+      debug            1 -- печатать отладочные сообщения (если собрано с DEBUG) */
+struct mem_config {
+  size_t              initial_size;
+  struct heap_options options;
+  void*               heap_start;
+  _Atomic size_t      region_min_size;
+  _Atomic size_t      growth_factor;
+  _Atomic size_t      mmap_threshold;
+  _Atomic size_t      trim_threshold;
+  _Atomic size_t      split_threshold;
+  _Atomic size_t      cache_size;
+  _Atomic size_t      profile_rate;
+  _Atomic size_t      check_interval;
+  size_t              size_classes[TCACHE_CLASSES];
+  size_t              size_class_count;
+  _Atomic bool        debug;
+};
+
+extern struct mem_config mem_config;
+
+/*  разобрать MEM_CONF; повторные вызовы ничего не делают */
+void mem_config_load( void );
+/*  разобрать строку в формате MEM_CONF; false, если встретился неизвестный ключ или плохое значение */
+bool mem_config_parse( const char* conf );
+
+#endif
@@ -0,0 +1,126 @@
+#include "config.h"
+#include "mem_internals.h"
+#include "mem.h"
+#include "util.h"
+
+/*  Список блоков проверяется по таблице регионов кучи, а не по самому себе: очередной заголовок
+    читается, только если он лежит там, где должен начаться следующий блок, поэтому испорченный
+    next не приводит к обращению по чужому адресу. Регионы добавляются только выше предыдущих,
+    и блоки обязаны покрывать их по порядку, вплотную и без зазоров; блок может продолжаться
+    в примыкающий регион (так grow_heap сливает хвост кучи с новым регионом). */
+
+#define HEADER_SIZE offsetof( struct block_header, contents )
+
+static uintptr_t region_end( struct region const* r ) { return (uintptr_t) r->addr + r->size; }
+
+static bool report_problem( struct heap_check_report* report, void const* block, const char* problem ) {
+  report->errors++;
+  if (!report->problem) {
+    report->bad_block = block;
+    report->problem = problem;
+  }
+  return false;
+}
+
+static bool in_known_region( struct heap const* heap, uintptr_t addr ) {
+  size_t lo = 0, hi = heap->regions_count;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (addr >= region_end( &heap->regions[mid] )) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo < heap->regions_count && addr >= (uintptr_t) heap->regions[lo].addr;
+}
+
+/*  сдвинуть текущий регион k так, чтобы addr (не включая) в него попадал; переходить можно
+    только в примыкающий регион */
+static bool cover( struct heap const* heap, size_t* k, uintptr_t addr ) {
+  while (addr > region_end( &heap->regions[*k] )) {
+    if (*k + 1 == heap->regions_count || (uintptr_t) heap->regions[*k + 1].addr != region_end( &heap->regions[*k] ))
+      return false;
+    (*k)++;
+  }
+  return true;
+}
+
+struct block_counts { size_t free, used; };
+
+/*  Проверить блоки, покрывающие регионы с 0 по last включительно. Если last -- последний регион,
+    список должен на нём и закончиться. */
+static bool check_prefix( struct heap const* heap, size_t last, struct heap_check_report* report, struct block_counts* counts ) {
+  const uintptr_t top = region_end( &heap->regions[heap->regions_count - 1] );
+  size_t k = 0;
+  uintptr_t pos = (uintptr_t) heap->regions[0].addr;
+  struct block_header const* prev = NULL;
+  bool prev_free_adjacent = false;
+
+  for (struct block_header const* b = heap->start; b; prev = b, b = b->next) {
+    if ((uintptr_t) b != pos) {
+      if (!prev) return report_problem( report, b, "heap does not start at its first region" );
+      return report_problem( report, prev, in_known_region( heap, (uintptr_t) b )
+                                           ? "next does not match block_after" : "next points outside known regions" );
+    }
+    if (!cover( heap, &k, pos + HEADER_SIZE )) return report_problem( report, b, "header runs past its region" );
+    if (b->capacity.bytes > top - pos - HEADER_SIZE) return report_problem( report, b, "capacity runs past the last region" );
+    const uintptr_t end = (uintptr_t) block_after( b );
+    if (!cover( heap, &k, end )) return report_problem( report, b, "block runs past its region" );
+    if (b->is_mapped) return report_problem( report, b, "separately mapped block in the heap list" );
+
+    report->blocks++;
+    if (b->is_free) counts->free++;
+    else counts->used++;
+    if (prev_free_adjacent && b->is_free) report->uncoalesced++;
+    prev_free_adjacent = b->is_free;
+
+    /*  блок мог пройти через несколько примыкающих регионов, в том числе за last */
+    if (k > last || (k == last && end == region_end( &heap->regions[k] ))) {
+      if (k + 1 == heap->regions_count && b->next)
+        return report_problem( report, b, "list continues past the last region" );
+      return true;
+    }
+    if (end == region_end( &heap->regions[k] )) {
+      /*  следующий регион может не примыкать: тогда соседние по списку блоки не соседи в памяти */
+      k++;
+      prev_free_adjacent = prev_free_adjacent && (uintptr_t) heap->regions[k].addr == end;
+      pos = (uintptr_t) heap->regions[k].addr;
+    } else {
+      pos = end;
+    }
+  }
+  return report_problem( report, prev ? (void const*) prev : (void const*) heap, "blocks do not add up to region sizes" );
+}
+
+static bool heap_checkable( struct heap const* heap ) {
+  return heap->start && !heap->regions_lost && heap->regions_count > 0;
+}
+
+static void check_heap( struct heap* heap, void* arg ) {
+  struct heap_check_report* report = arg;
+  report->heaps++;
+  if (!heap->start) return;
+  if (!heap_checkable( heap )) { report->skipped++; return; }
+  report->regions += heap->regions_count;
+  struct block_counts counts = {0};
+  if (check_prefix( heap, heap->regions_count - 1, report, &counts )
+      && (counts.free != heap->stats.free_blocks || counts.used != heap->stats.used_blocks))
+    report_problem( report, heap->start, "block counters disagree with the list" );
+}
+
+struct heap_check_report heap_check( void ) {
+  struct heap_check_report report = {0};
+  heap_for_each( check_heap, &report );
+  return report;
+}
+
+/*  До региона r можно добраться только по списку от начала, так что проверка региона r -- это
+    проверка всего префикса до него; по кругу в среднем проходится половина списка, то есть
+    примерно столько же, сколько стоит один поиск первого подходящего в memalloc. */
+void heap_check_sampled( struct heap* heap ) {
+  if (!heap_checkable( heap )) return;
+  if (heap->check_next >= heap->regions_count) heap->check_next = 0;
+  const size_t last = heap->check_next++;
+  struct heap_check_report report = {0};
+  struct block_counts counts = {0};
+  if (!check_prefix( heap, last, &report, &counts ))
+    err( "heap_check: %s at %p (checking region %zu of %zu)\n", report.problem, report.bad_block, last, heap->regions_count );
+}
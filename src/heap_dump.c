@@ -0,0 +1,212 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+
+#include "mem_internals.h"
+#include "mem.h"
+#include "sizehist.h"
+#include "writer.h"
+
+/*  Дамп идёт одним проходом по кучам под их мьютексами: строки блоков пишутся сразу,
+    а сводки копятся в состоянии и выводятся в конце. Регионом здесь называется непрерывная
+    цепочка блоков: регионы, выросшие вплотную друг к другу, сливаются в один. */
+
+#define DUMP_WRITER_BUFFER (1 << 20)
+
+struct region_summary {
+  size_t      heap;
+  uintptr_t   address;
+  size_t      size, used_bytes, free_bytes, header_bytes, blocks;
+};
+
+struct dump_state {
+  struct writer                  w;
+  enum heap_dump_format          format;
+  struct heap_dump_filter        filter;
+  size_t                         heap;
+  uint64_t                       free_blocks[SIZE_BUCKETS];
+  uint64_t                       free_bytes[SIZE_BUCKETS];
+  struct region_summary*         regions;
+  size_t                         regions_count, regions_capacity;
+  bool                           out_of_memory;
+  /*  наибольшая цепочка соседних свободных блоков, вместе с заголовками внутри неё */
+  size_t                         run_heap, run_bytes, run_blocks;
+  uintptr_t                      run_address;
+};
+
+/*  --- Поля записей: в CSV -- через запятую, в JSON Lines -- "имя": значение --- */
+
+static void field_name( struct dump_state* s, const char* name ) {
+  if (s->format == HEAP_DUMP_CSV) { writer_put( &s->w, ",", 1 ); return; }
+  writer_string( &s->w, ", \"" );
+  writer_string( &s->w, name );
+  writer_string( &s->w, "\": " );
+}
+
+static void record_begin( struct dump_state* s, const char* record ) {
+  if (s->format == HEAP_DUMP_CSV) { writer_string( &s->w, record ); return; }
+  writer_string( &s->w, "{\"record\": \"" );
+  writer_string( &s->w, record );
+  writer_put( &s->w, "\"", 1 );
+}
+
+static void record_end( struct dump_state* s ) {
+  writer_string( &s->w, s->format == HEAP_DUMP_CSV ? "\n" : "}\n" );
+}
+
+static void field_decimal( struct dump_state* s, const char* name, uint64_t value ) {
+  field_name( s, name );
+  writer_decimal( &s->w, value );
+}
+
+static void field_address( struct dump_state* s, const char* name, uintptr_t value ) {
+  field_name( s, name );
+  if (s->format == HEAP_DUMP_JSONL) writer_put( &s->w, "\"", 1 );
+  writer_hex( &s->w, value );
+  if (s->format == HEAP_DUMP_JSONL) writer_put( &s->w, "\"", 1 );
+}
+
+static void field_bool( struct dump_state* s, const char* name, bool value ) {
+  field_name( s, name );
+  writer_string( &s->w, value ? "true" : "false" );
+}
+
+/*  в CSV перед каждой секцией идёт строка "#запись,поле,поле,..." с именами столбцов */
+static void csv_header( struct dump_state* s, const char* columns ) {
+  if (s->format != HEAP_DUMP_CSV) return;
+  writer_put( &s->w, "#", 1 );
+  writer_string( &s->w, columns );
+  writer_put( &s->w, "\n", 1 );
+}
+
+/*  --- Обход --- */
+
+static bool block_selected( struct heap_dump_filter const* f, struct block_header const* b ) {
+  if (f->free_only && !b->is_free) return false;
+  if (b->capacity.bytes < f->min_capacity) return false;
+  if (f->from && (void const*) b < f->from) return false;
+  if (f->to && (void const*) b >= f->to) return false;
+  return true;
+}
+
+static struct region_summary* region_new( struct dump_state* s, struct block_header const* first ) {
+  if (s->regions_count == s->regions_capacity) {
+    const size_t capacity = s->regions_capacity ? 2 * s->regions_capacity : 256;
+    struct region_summary* grown = map_pages( NULL, capacity * sizeof( struct region_summary ), 0 );
+    if (grown == MAP_FAILED) { s->out_of_memory = true; return NULL; }
+    if (s->regions) {
+      memcpy( grown, s->regions, s->regions_count * sizeof( struct region_summary ) );
+      munmap( s->regions, s->regions_capacity * sizeof( struct region_summary ) );
+    }
+    s->regions = grown;
+    s->regions_capacity = capacity;
+  }
+  struct region_summary* r = &s->regions[s->regions_count++];
+  *r = (struct region_summary) { .heap = s->heap, .address = (uintptr_t) first };
+  return r;
+}
+
+static void dump_block( struct dump_state* s, struct block_header const* b, size_t region ) {
+  record_begin( s, "block" );
+  field_decimal( s, "heap", s->heap );
+  field_decimal( s, "region", region );
+  field_address( s, "address", (uintptr_t) b );
+  field_decimal( s, "capacity", b->capacity.bytes );
+  field_bool( s, "free", b->is_free );
+  record_end( s );
+}
+
+static void dump_heap( struct heap* heap, void* arg ) {
+  struct dump_state* s = arg;
+  struct region_summary* region = NULL;
+  size_t region_index = 0, run_bytes = 0, run_blocks = 0;
+  uintptr_t run_address = 0;
+  struct block_header const* previous = NULL;
+
+  for (struct block_header const* b = heap->start; b; previous = b, b = b->next) {
+    const bool contiguous = previous && block_after( previous ) == b;
+    if (!contiguous) {
+      if (previous) region_index++;
+      region = region_new( s, b );
+    }
+    if (region) {
+      region->size += size_from_capacity( b->capacity ).bytes;
+      region->header_bytes += offsetof( struct block_header, contents );
+      region->blocks++;
+      if (b->is_free) region->free_bytes += b->capacity.bytes;
+      else region->used_bytes += b->capacity.bytes;
+    }
+
+    if (b->is_free) {
+      const size_t bucket = size_bucket_index( b->capacity.bytes );
+      s->free_blocks[bucket]++;
+      s->free_bytes[bucket] += b->capacity.bytes;
+      if (!contiguous || !previous->is_free) { run_address = (uintptr_t) b; run_bytes = 0; run_blocks = 0; }
+      run_bytes += run_blocks ? size_from_capacity( b->capacity ).bytes : b->capacity.bytes;
+      run_blocks++;
+      if (run_bytes > s->run_bytes) {
+        s->run_heap = s->heap;
+        s->run_address = run_address;
+        s->run_bytes = run_bytes;
+        s->run_blocks = run_blocks;
+      }
+    }
+
+    if (block_selected( &s->filter, b )) dump_block( s, b, region_index );
+  }
+  s->heap++;
+}
+
+static void dump_summaries( struct dump_state* s ) {
+  csv_header( s, "free_histogram,size_from,blocks,bytes" );
+  for (size_t i = 0; i < SIZE_BUCKETS; i++) {
+    if (!s->free_blocks[i]) continue;
+    record_begin( s, "free_histogram" );
+    field_decimal( s, "size_from", size_bucket_lower( i ) );
+    field_decimal( s, "blocks", s->free_blocks[i] );
+    field_decimal( s, "bytes", s->free_bytes[i] );
+    record_end( s );
+  }
+
+  csv_header( s, "region,heap,address,size,used_bytes,free_bytes,header_bytes,blocks" );
+  for (size_t i = 0; i < s->regions_count; i++) {
+    struct region_summary const* r = &s->regions[i];
+    record_begin( s, "region" );
+    field_decimal( s, "heap", r->heap );
+    field_address( s, "address", r->address );
+    field_decimal( s, "size", r->size );
+    field_decimal( s, "used_bytes", r->used_bytes );
+    field_decimal( s, "free_bytes", r->free_bytes );
+    field_decimal( s, "header_bytes", r->header_bytes );
+    field_decimal( s, "blocks", r->blocks );
+    record_end( s );
+  }
+
+  csv_header( s, "largest_free_run,heap,address,bytes,blocks" );
+  record_begin( s, "largest_free_run" );
+  field_decimal( s, "heap", s->run_heap );
+  field_address( s, "address", s->run_address );
+  field_decimal( s, "bytes", s->run_bytes );
+  field_decimal( s, "blocks", s->run_blocks );
+  record_end( s );
+}
+
+bool heap_dump( int fd, enum heap_dump_format format, struct heap_dump_filter const* filter ) {
+  static const struct heap_dump_filter everything = {0};
+  struct dump_state* s = map_pages( NULL, sizeof( struct dump_state ), 0 );
+  if (s == MAP_FAILED) return false;
+  s->format = format;
+  s->filter = filter ? *filter : everything;
+  if (!writer_open( &s->w, fd, DUMP_WRITER_BUFFER )) {
+    munmap( s, sizeof( struct dump_state ) );
+    return false;
+  }
+
+  csv_header( s, "block,heap,region,address,capacity,free" );
+  heap_for_each( dump_heap, s );
+  dump_summaries( s );
+
+  const bool ok = writer_close( &s->w ) && !s->out_of_memory;
+  if (s->regions) munmap( s->regions, s->regions_capacity * sizeof( struct region_summary ) );
+  munmap( s, sizeof( struct dump_state ) );
+  return ok;
+}
@@ -0,0 +1,112 @@
+#define _DEFAULT_SOURCE
+#include <execinfo.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "latency.h"
+
+uint64_t latency_now( void ) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+const char* latency_unit( void ) {
+#if defined(__x86_64__) || defined(__i386__)
+  return "cycles";
+#else
+  return "ns";
+#endif
+}
+
+size_t latency_bucket_index( uint64_t value ) {
+  if (value < 2 * LATENCY_SUB_BUCKETS) return value;
+  const size_t log = 63 - __builtin_clzll( value );
+  const size_t sub = (value >> (log - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+  return (log - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+uint64_t latency_bucket_lower( size_t index ) {
+  if (index < 2 * LATENCY_SUB_BUCKETS) return index;
+  const size_t log = index / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+  return (uint64_t) (LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << (log - LATENCY_SUB_BITS);
+}
+
+void latency_histogram_record( struct latency_histogram* h, uint64_t value ) {
+  atomic_fetch_add_explicit( &h->counts[latency_bucket_index( value )], 1, memory_order_relaxed );
+  atomic_fetch_add_explicit( &h->total, 1, memory_order_relaxed );
+  uint64_t max = atomic_load_explicit( &h->max, memory_order_relaxed );
+  while (value > max && !atomic_compare_exchange_weak_explicit( &h->max, &max, value,
+                                                                memory_order_relaxed, memory_order_relaxed ))
+    ;
+}
+
+uint64_t latency_histogram_percentile( struct latency_histogram const* h, double percentile ) {
+  const uint64_t total = atomic_load_explicit( &h->total, memory_order_relaxed );
+  if (total == 0) return 0;
+  uint64_t rank = (uint64_t) (percentile / 100.0 * (double) total + 0.5);
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += atomic_load_explicit( &h->counts[i], memory_order_relaxed );
+    if (seen >= rank) return latency_bucket_lower( i );
+  }
+  return atomic_load_explicit( &h->max, memory_order_relaxed );
+}
+
+void latency_histogram_reset( struct latency_histogram* h ) {
+  for (size_t i = 0; i < LATENCY_BUCKETS; i++) atomic_store_explicit( &h->counts[i], 0, memory_order_relaxed );
+  atomic_store_explicit( &h->total, 0, memory_order_relaxed );
+  atomic_store_explicit( &h->max, 0, memory_order_relaxed );
+}
+
+/*  --- Замеры аллокатора --- */
+
+static struct latency_histogram path_histograms[LATENCY_PATHS];
+static _Atomic uint64_t slow_threshold;
+static struct latency_sample slow_samples[LATENCY_SLOW_SAMPLES];
+static _Atomic size_t slow_count;
+
+struct latency_histogram const* latency_path_histogram( enum latency_path path ) { return &path_histograms[path]; }
+
+void latency_set_threshold( uint64_t duration ) { atomic_store_explicit( &slow_threshold, duration, memory_order_relaxed ); }
+
+/*  медленные операции пишутся в кольцо; читатель может увидеть запись, которую как раз перезаписывают --
+    для диагностики этого достаточно */
+void latency_record( enum latency_path path, uint64_t start, size_t query ) {
+  latency_record_duration( path, latency_now() - start, query );
+}
+
+void latency_record_duration( enum latency_path path, uint64_t duration, size_t query ) {
+  latency_histogram_record( &path_histograms[path], duration );
+
+  const uint64_t threshold = atomic_load_explicit( &slow_threshold, memory_order_relaxed );
+  if (threshold == 0 || duration < threshold) return;
+  const size_t i = atomic_fetch_add_explicit( &slow_count, 1, memory_order_relaxed ) % LATENCY_SLOW_SAMPLES;
+  struct latency_sample* sample = &slow_samples[i];
+  sample->path = path;
+  sample->duration = duration;
+  sample->query = query;
+  sample->depth = backtrace( sample->stack, LATENCY_STACK_DEPTH );
+}
+
+size_t latency_slow_samples( struct latency_sample* out, size_t max ) {
+  const size_t count = atomic_load_explicit( &slow_count, memory_order_relaxed );
+  const size_t available = count < LATENCY_SLOW_SAMPLES ? count : LATENCY_SLOW_SAMPLES;
+  size_t copied = 0;
+  for (; copied < available && copied < max; copied++)
+    out[copied] = slow_samples[(count - 1 - copied) % LATENCY_SLOW_SAMPLES];
+  return copied;
+}
+
+void latency_reset( void ) {
+  for (size_t p = 0; p < LATENCY_PATHS; p++) latency_histogram_reset( &path_histograms[p] );
+  atomic_store_explicit( &slow_count, 0, memory_order_relaxed );
+}
@@ -0,0 +1,66 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Гистограммы задержек в духе HDR: логарифмические корзины, каждая поделена на 2^LATENCY_SUB_BITS
+    линейных частей, то есть относительная погрешность не больше 1/8. Время меряется в тактах rdtsc
+    на x86 и в наносекундах clock_gettime на остальных платформах.
+
+    Сами гистограммы доступны всегда (ими пользуются бенчмарки), а замеры внутри _malloc/_free
+    появляются только при сборке с MEM_LATENCY (make LATENCY=1); без него они не компилируются вовсе. */
+
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+#define LATENCY_SLOW_SAMPLES 64
+#define LATENCY_STACK_DEPTH 16
+
+/*  fast -- блок нашёлся среди первых LATENCY_FAST_STEPS блоков списка, search -- пришлось идти дальше,
+    grow -- сам вызов grow_heap (внутри search), free -- _free целиком */
+enum latency_path { LATENCY_FAST, LATENCY_SEARCH, LATENCY_GROW, LATENCY_FREE, LATENCY_PATHS };
+
+#define LATENCY_FAST_STEPS 8
+
+struct latency_histogram {
+  _Atomic uint64_t counts[LATENCY_BUCKETS];
+  _Atomic uint64_t total;
+  _Atomic uint64_t max;
+};
+
+/*  операция дольше порога (если он задан) сохраняется вместе со стеком вызовов */
+struct latency_sample {
+  enum latency_path path;
+  uint64_t          duration;
+  size_t            query;
+  int               depth;
+  void*             stack[LATENCY_STACK_DEPTH];
+};
+
+uint64_t    latency_now( void );
+const char* latency_unit( void );
+
+size_t   latency_bucket_index( uint64_t value );
+uint64_t latency_bucket_lower( size_t index );
+
+void     latency_histogram_record( struct latency_histogram* h, uint64_t value );
+/*  наименьшее значение, не меньше которого доля percentile (0..100) всех записей */
+uint64_t latency_histogram_percentile( struct latency_histogram const* h, double percentile );
+void     latency_histogram_reset( struct latency_histogram* h );
+
+/*  --- Замеры аллокатора (имеют смысл только в сборке с MEM_LATENCY) --- */
+
+struct latency_histogram const* latency_path_histogram( enum latency_path path );
+void   latency_set_threshold( uint64_t duration );
+void   latency_record( enum latency_path path, uint64_t start, size_t query );
+/*  то же для уже измеренной длительности; стек снимается здесь, поэтому не под мьютексом кучи:
+    backtrace при первом вызове может сам выделять память */
+void   latency_record_duration( enum latency_path path, uint64_t duration, size_t query );
+/*  скопировать до max последних медленных операций, вернуть их количество */
+size_t latency_slow_samples( struct latency_sample* out, size_t max );
+void   latency_reset( void );
+
+#endif
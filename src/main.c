@@ -2,5 +2,5 @@
 
 
 int main() {
-    run_tests();
+    return run_tests() ? 0 : 1;
 }
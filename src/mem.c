@@ -4,12 +4,56 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
+#include "config.h"
 #include "mem_internals.h"
 #include "mem.h"
+#include "profile.h"
+#include "sizehist.h"
+#include "trace.h"
 #include "util.h"
 
+/*  место выделения хранится в заголовке только при MEM_LEAK_SITES */
+#ifdef MEM_LEAK_SITES
+#define LEAK_SITE( mem, address ) do { if (mem) block_get_header( mem )->site = (address); } while (0)
+#else
+#define LEAK_SITE( mem, address )
+#endif
+
+/*  замеры задержек компилируются только при MEM_LATENCY, иначе макросы раскрываются в пустоту */
+#ifdef MEM_LATENCY
+#include "latency.h"
+static _Thread_local size_t latency_steps;
+#define LATENCY_START( var )              const uint64_t var = latency_now()
+#define LATENCY_RECORD( path, var, query ) latency_record( (path), (var), (query) )
+#define LATENCY_STEP()                    (latency_steps++)
+#define LATENCY_SET_STEPS( n )            (latency_steps = (n))
+#define LATENCY_MALLOC_PATH()             (latency_steps <= LATENCY_FAST_STEPS ? LATENCY_FAST : LATENCY_SEARCH)
+/*  рост кучи измеряется под мьютексом, а записывается после его освобождения (LATENCY_GROW_FLUSH);
+    если под одним захватом куча росла несколько раз, записывается последний рост */
+static _Thread_local struct { uint64_t duration; size_t query; bool pending; } latency_grow;
+#define LATENCY_GROW_DONE( var, size ) \
+  (latency_grow.duration = latency_now() - (var), latency_grow.query = (size), latency_grow.pending = true)
+#define LATENCY_GROW_FLUSH() \
+  do { \
+    if (latency_grow.pending) { \
+      latency_grow.pending = false; \
+      latency_record_duration( LATENCY_GROW, latency_grow.duration, latency_grow.query ); \
+    } \
+  } while (0)
+#else
+#define LATENCY_START( var )
+#define LATENCY_RECORD( path, var, query )
+#define LATENCY_STEP()
+#define LATENCY_SET_STEPS( n )
+#define LATENCY_GROW_DONE( var, size )
+#define LATENCY_GROW_FLUSH()
+#endif
+
 void debug_block(struct block_header* b, const char* fmt, ... );
 void debug(const char* fmt, ... );
 
@@ -19,16 +63,23 @@ extern inline block_capacity capacity_from_size( block_size sz );
 static bool            block_is_big_enough( size_t query, struct block_header* block ) { return block->capacity.bytes >= query; }
 static size_t          pages_count   ( size_t mem )                      { return mem / getpagesize() + ((mem % getpagesize()) > 0); }
 static size_t          round_pages   ( size_t mem )                      { return getpagesize() * pages_count( mem ) ; }
+/*  вместимость блока под запрос: не меньше BLOCK_MIN_CAPACITY и кратна BLOCK_ALIGN */
+static size_t          round_capacity( size_t query )                    { return (size_max( BLOCK_MIN_CAPACITY, query ) + BLOCK_ALIGN - 1) & ~(size_t) (BLOCK_ALIGN - 1); }
+
+/*  больше не выделить никогда; проверка до округлений, чтобы они не переполнились */
+#define QUERY_MAX ((size_t) PTRDIFF_MAX)
 
 static void block_init( void* restrict addr, block_size block_sz, void* restrict next ) {
   *((struct block_header*)addr) = (struct block_header) {
     .next = next,
     .capacity = capacity_from_size(block_sz),
-    .is_free = true
+    .is_free = true,
+    .is_mapped = false,
+    .is_sampled = false
   };
 }
 
-static size_t region_actual_size( size_t query ) { return size_max( round_pages( query ), REGION_MIN_SIZE ); }
+static size_t region_actual_size( size_t query ) { return size_max( round_pages( query ), mem_config.region_min_size ); }
 
 extern inline bool region_is_invalid( const struct region* r );
 
@@ -38,8 +89,9 @@ void* map_pages(void const* addr, size_t length, int additional_flags) {
   return mmap( (void*) addr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | additional_flags , 0, 0 );
 }
 
-/*  аллоцировать регион памяти и инициализировать его блоком */
-static struct region alloc_region  ( void const * addr, size_t query ) {
+/*  аллоцировать регион памяти и инициализировать его блоком; on_region кучи вызывается до записи
+    заголовка, иначе первая страница региона попала бы на узел текущего потока до привязки */
+static struct region alloc_region  ( struct heap* heap, void const * addr, size_t query ) {
   //---------------------------------------------------------------------
   if (addr == NULL)
       return REGION_INVALID;
@@ -49,6 +101,7 @@ static struct region alloc_region  ( void const * addr, size_t query ) {
   if ((reg_addr == MAP_FAILED) || (reg_addr == NULL))
       return REGION_INVALID;
 
+    if (heap->on_region) heap->on_region( heap, reg_addr, size );
     block_init(reg_addr, (block_size) {.bytes = size}, NULL);
 
     return (struct region) {.addr = reg_addr, .size = size, .extends = true};
@@ -57,22 +110,145 @@ static struct region alloc_region  ( void const * addr, size_t query ) {
 
 void* block_after( struct block_header const* block )         ;
 
-void* heap_init( size_t initial ) {
-  const struct region region = alloc_region( HEAP_START, initial );
+/*  основная куча, с которой работают _malloc и _free */
+static struct heap main_heap = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*  кучи с собственным окном адресов; по нему _free находит, какой куче принадлежит блок */
+#define HEAPS_MAX 64
+static struct heap* heaps[HEAPS_MAX];
+static _Atomic size_t heaps_count;
+
+static bool heap_owns( struct heap const* heap, void const* addr ) {
+  return (uint8_t const*) addr >= (uint8_t const*) heap->span_begin && (uint8_t const*) addr < (uint8_t const*) heap->span_end;
+}
+
+static struct heap* heap_of( void const* mem ) {
+  const size_t count = atomic_load_explicit( &heaps_count, memory_order_acquire );
+  for (size_t i = 0; i < count; i++)
+    if (heap_owns( heaps[i], mem )) return heaps[i];
+  return &main_heap;
+}
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+/*  заранее получить страницы диапазона, чтобы первое обращение к ним не стоило page fault;
+    на ядрах без MADV_POPULATE_WRITE (до 5.14) просто касаемся каждой страницы */
+static void prefault_range( void* addr, size_t length ) {
+  uint8_t* begin = (uint8_t*) ((uintptr_t) addr & ~((uintptr_t) getpagesize() - 1));
+  uint8_t* end = (uint8_t*) addr + length;
+  if (madvise( begin, end - begin, MADV_POPULATE_WRITE ) == 0) return;
+  for (volatile uint8_t* page = begin; page < end; page += getpagesize())
+    *page = *page;
+}
+
+/*  --- Статистика ---
+    Счётчики меняются вместе с блоками под мьютексом кучи. Наибольший свободный блок точно известен,
+    пока свободные блоки только растут; если уменьшился блок, который мог быть наибольшим,
+    значение помечается устаревшим и пересчитывается обходом при следующем heap_stats. */
+
+#define BLOCK_HEADER_SIZE offsetof( struct block_header, contents )
+
+static void stats_free_grew( struct heap* heap, size_t capacity ) {
+  if (capacity > heap->stats.largest_free) heap->stats.largest_free = capacity;
+}
+
+static void stats_free_shrank( struct heap* heap, size_t old_capacity ) {
+  if (old_capacity >= heap->stats.largest_free) heap->largest_free_stale = true;
+}
+
+static void stats_block_taken( struct heap* heap, size_t capacity ) {
+  heap->stats.free_blocks--; heap->stats.used_blocks++;
+  heap->stats.free_bytes -= capacity; heap->stats.in_use_bytes += capacity;
+  stats_free_shrank( heap, capacity );
+}
+
+static void stats_block_released( struct heap* heap, size_t capacity ) {
+  heap->stats.used_blocks--; heap->stats.free_blocks++;
+  heap->stats.in_use_bytes -= capacity; heap->stats.free_bytes += capacity;
+  stats_free_grew( heap, capacity );
+}
+
+/*  таблица регионов живёт в собственном отображении и растёт удвоением; регионы добавляются
+    только выше предыдущих, поэтому она остаётся упорядоченной */
+static void heap_record_region( struct heap* heap, struct region const* region ) {
+  if (heap->regions_lost) return;
+  if (heap->regions_count == heap->regions_capacity) {
+    const size_t capacity = heap->regions_capacity ? 2 * heap->regions_capacity : 64;
+    struct region* grown = map_pages( NULL, capacity * sizeof( struct region ), 0 );
+    if (grown == MAP_FAILED) { heap->regions_lost = true; return; }
+    if (heap->regions) {
+      memcpy( grown, heap->regions, heap->regions_count * sizeof( struct region ) );
+      munmap( heap->regions, heap->regions_capacity * sizeof( struct region ) );
+    }
+    heap->regions = grown;
+    heap->regions_capacity = capacity;
+  }
+  heap->regions[heap->regions_count++] = *region;
+}
+
+static void heap_new_region( struct heap* heap, struct region const* region ) {
+  heap_record_region( heap, region );
+  heap->last_region_size = region->size;
+  heap->stats.mapped_bytes += region->size;
+  heap->stats.regions++;
+  heap->stats.free_blocks++;
+  heap->stats.header_bytes += BLOCK_HEADER_SIZE;
+  heap->stats.free_bytes += region->size - BLOCK_HEADER_SIZE;
+  stats_free_grew( heap, region->size - BLOCK_HEADER_SIZE );
+  if (heap->options.prefault) prefault_range( region->addr, region->size );
+}
+
+void* heap_create( struct heap* heap, size_t initial ) {
+  const struct region region = alloc_region( heap, heap->span_begin, initial );
   if ( region_is_invalid(&region) ) return NULL;
+  heap->start = region.addr;
+  heap_new_region( heap, &region );
 
+  if (heap != &main_heap) {
+    const size_t i = atomic_fetch_add( &heaps_count, 1 );
+    if (i >= HEAPS_MAX) err( "heap_create: more than %d heaps\n", HEAPS_MAX );
+    heaps[i] = heap;
+  }
   return region.addr;
 }
 
-#define BLOCK_MIN_CAPACITY 24
+/*  выставляется, когда основная куча создана; _malloc проверяет его одним предсказуемым переходом */
+static _Atomic bool heap_ready;
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+bool heap_is_ready( void ) { return atomic_load_explicit( &heap_ready, memory_order_acquire ); }
+
+/*  повторный вызов после явной или ленивой инициализации возвращает уже существующую кучу */
+void* heap_init_with( size_t initial, struct heap_options options ) {
+  pthread_mutex_lock( &main_heap.lock );
+  if (!main_heap.start) {
+    mem_config_load();
+    main_heap.span_begin = mem_config.heap_start;
+    main_heap.options = options;
+    if (heap_create( &main_heap, initial )) {
+      atomic_store_explicit( &heap_ready, true, memory_order_release );
+#ifdef MEM_LEAK_SITES
+      atexit( heap_leak_report_at_exit );
+#endif
+    }
+  }
+  pthread_mutex_unlock( &main_heap.lock );
+  return main_heap.start;
+}
+
+void* heap_init( size_t initial ) {
+  return heap_init_with( initial, (struct heap_options) {0} );
+}
 
 /*  --- Разделение блоков (если найденный свободный блок слишком большой )--- */
 
 static bool block_splittable( struct block_header* restrict block, size_t query) {
-  return block-> is_free && query + offsetof( struct block_header, contents ) + BLOCK_MIN_CAPACITY <= block->capacity.bytes;
+  return block-> is_free && query + offsetof( struct block_header, contents ) + mem_config.split_threshold <= block->capacity.bytes;
 }
 
-static bool split_if_too_big( struct block_header* block, size_t query ) {
+static bool split_if_too_big( struct heap* heap, struct block_header* block, size_t query ) {
   //-------------------------------------------------------------------------
     if (block == NULL)
         return false;
@@ -81,6 +257,10 @@ static bool split_if_too_big( struct block_header* block, size_t query ) {
         return false;
 
     query = size_max(BLOCK_MIN_CAPACITY, query);
+    stats_free_shrank(heap, block->capacity.bytes);
+    heap->stats.free_blocks++;
+    heap->stats.header_bytes += BLOCK_HEADER_SIZE;
+    heap->stats.free_bytes -= BLOCK_HEADER_SIZE;
     block_size second_block = {.bytes = block->capacity.bytes - query};
     block->capacity.bytes = query;
     void * second_block_add = block_after(block);
@@ -106,7 +286,7 @@ static bool mergeable(struct block_header const* restrict fst, struct block_head
   return fst->is_free && snd->is_free && blocks_continuous( fst, snd ) ;
 }
 
-static bool try_merge_with_next( struct block_header* block ) {
+static bool try_merge_with_next( struct heap* heap, struct block_header* block ) {
   //-----------------------------------------------------------------------------
     if (block == NULL)
         return false;
@@ -120,6 +300,10 @@ static bool try_merge_with_next( struct block_header* block ) {
 
     block->next = new_block->next;
     block->capacity.bytes = block->capacity.bytes + size_from_capacity(new_block->capacity).bytes;
+    heap->stats.free_blocks--;
+    heap->stats.header_bytes -= BLOCK_HEADER_SIZE;
+    heap->stats.free_bytes += BLOCK_HEADER_SIZE;
+    stats_free_grew(heap, block->capacity.bytes);
     return true;
   //-----------------------------------------------------------------------------
 }
@@ -143,6 +327,7 @@ static struct block_search_result find_good_or_last  ( struct block_header* rest
     struct block_header * current_block = block;
 
     while (current_block != NULL) {
+        LATENCY_STEP();
         if ((current_block->is_free) && (block_is_big_enough(sz, current_block)))
             return (struct block_search_result) {.block = current_block, .type = BSR_FOUND_GOOD_BLOCK};
 
@@ -158,7 +343,7 @@ static struct block_search_result find_good_or_last  ( struct block_header* rest
 
 /*  Попробовать выделить память в куче начиная с блока `block` не пытаясь расширить кучу
  Можно переиспользовать как только кучу расширили. */
-static struct block_search_result try_memalloc_existing ( size_t query, struct block_header* block ) {
+static struct block_search_result try_memalloc_existing ( struct heap* heap, size_t query, struct block_header* block ) {
   //----------------------------------------------------------------------------------
     if (block == NULL)
         return (struct block_search_result) {.type = BSR_CORRUPTED};
@@ -167,8 +352,9 @@ static struct block_search_result try_memalloc_existing ( size_t query, struct b
     struct block_search_result new_block = find_good_or_last(block, query);
 
     if (new_block.type == BSR_FOUND_GOOD_BLOCK) {
-        split_if_too_big(new_block.block, query);
+        split_if_too_big(heap, new_block.block, query);
         new_block.block->is_free = false;
+        stats_block_taken(heap, new_block.block->capacity.bytes);
     }
 
     return new_block;
@@ -178,31 +364,59 @@ static struct block_search_result try_memalloc_existing ( size_t query, struct b
 
 
 
-static struct block_header* grow_heap( struct block_header* restrict last, size_t query ) {
+static struct block_header* grow_heap( struct heap* heap, struct block_header* restrict last, size_t query ) {
   //---------------------------------------------------------------------------------
     if (last == NULL)
         return NULL;
     if (BLOCK_MIN_CAPACITY > query)
         query = BLOCK_MIN_CAPACITY;
+    const size_t factor = mem_config.growth_factor;
+    if (factor > 1) {
+        size_t grown;
+        if (__builtin_mul_overflow(heap->last_region_size, factor, &grown) || grown > REGION_GROWTH_MAX)
+            grown = REGION_GROWTH_MAX;
+        query = size_max(query, grown);
+    }
     void* new_block = block_after(last);
-    last->next = alloc_region(new_block, query).addr;
+    if (heap->span_end && (uint8_t*) new_block + region_actual_size(query) > (uint8_t*) heap->span_end)
+        return NULL;
+    const struct region region = alloc_region(heap, new_block, query);
+    last->next = region.addr;
+    if (region_is_invalid(&region))
+        return NULL;
+    heap_new_region(heap, &region);
+    heap->stats.grows++;
+    TRACE_EVENT(TRACE_GROW, region.addr, NULL, region.size);
 
-    if (!try_merge_with_next(last))
+    if (!try_merge_with_next(heap, last))
         return last->next;
     else
         return last;
   //---------------------------------------------------------------------------------
 }
 
+/*  выключенная выборочная проверка стоит одного перехода */
+static inline void heap_check_tick( struct heap* heap ) {
+  if (__builtin_expect( mem_config.check_interval != 0, 0 ) && ++heap->check_ops >= mem_config.check_interval) {
+    heap->check_ops = 0;
+    heap_check_sampled( heap );
+  }
+}
+
 /*  Реализует основную логику malloc и возвращает заголовок выделенного блока */
-static struct block_header* memalloc( size_t query, struct block_header* heap_start) {
+static struct block_header* memalloc( size_t query, struct heap* heap ) {
     //-------------------------------------------------------------------
+    struct block_header* heap_start = heap->start;
     if (heap_start == NULL)
         return NULL;
-    struct block_search_result result = try_memalloc_existing(query, heap_start);
+    query = round_capacity(query);
+    struct block_search_result result = try_memalloc_existing(heap, query, heap_start);
     if (result.type == BSR_REACHED_END_NOT_FOUND) {
-        grow_heap(result.block, query);
-        result = try_memalloc_existing(query, heap_start);
+        LATENCY_START(grow_start);
+        grow_heap(heap, result.block, query);
+        LATENCY_GROW_DONE(grow_start, query);
+        LATENCY_SET_STEPS(SIZE_MAX);
+        result = try_memalloc_existing(heap, query, heap_start);
     }
     if (result.type != BSR_FOUND_GOOD_BLOCK)
         return NULL;
@@ -211,25 +425,483 @@ static struct block_header* memalloc( size_t query, struct block_header* heap_st
 
 }
 
-void* _malloc( size_t query ) {
-  struct block_header* const addr = memalloc( query, (struct block_header*) HEAP_START );
+static void shrink_taken( struct heap* heap, struct block_header* block, size_t query );
+
+/*  Выделение с выравниванием больше BLOCK_ALIGN: обычным поиском берётся блок с запасом
+    на выравнивание, часть перед выровненным адресом отделяется свободным блоком (запас
+    гарантирует, что она не меньше минимального блока), лишний хвост возвращается как при realloc. */
+static struct block_header* memalloc_aligned( size_t alignment, size_t query, struct heap* heap ) {
+  if (alignment > QUERY_MAX / 2 || query > QUERY_MAX / 2) return NULL;
+  query = round_capacity( query );
+  const size_t lead_min = BLOCK_HEADER_SIZE + BLOCK_MIN_CAPACITY;
+  struct block_header* block = memalloc( query + alignment + lead_min, heap );
+  if (block == NULL || ((uintptr_t) block->contents & (alignment - 1)) == 0) {
+    if (block) shrink_taken( heap, block, query );
+    return block;
+  }
+
+  const uintptr_t aligned = ((uintptr_t) block->contents + lead_min + alignment - 1) & ~(uintptr_t) (alignment - 1);
+  struct block_header* taken = (struct block_header*) (aligned - BLOCK_HEADER_SIZE);
+  const size_t lead = (uintptr_t) taken - (uintptr_t) block->contents;
+  block_init( taken, (block_size) { (uintptr_t) block_after( block ) - (uintptr_t) taken }, block->next );
+  taken->is_free = false;
+  block->capacity.bytes = lead;
+  block->next = taken;
+  block->is_free = true;
+  heap->stats.in_use_bytes -= lead + BLOCK_HEADER_SIZE;
+  heap->stats.free_blocks++;
+  heap->stats.free_bytes += lead;
+  heap->stats.header_bytes += BLOCK_HEADER_SIZE;
+  stats_free_grew( heap, lead );
+  shrink_taken( heap, taken, query );
+  return taken;
+}
+
+/*  куча общая для всех потоков, поэтому выделение и освобождение сериализуются на её мьютексе */
+static void* heap_malloc_aligned( struct heap* heap, size_t alignment, size_t query ) {
+  if (query > QUERY_MAX) return NULL;
+  LATENCY_START( start );
+  LATENCY_SET_STEPS( 0 );
+  pthread_mutex_lock( &heap->lock );
+  heap_check_tick( heap );
+  struct block_header* const addr = alignment <= BLOCK_ALIGN ? memalloc( query, heap ) : memalloc_aligned( alignment, query, heap );
+  heap->trimmed = NULL;
+  if (addr) heap->stats.mallocs++;
+  pthread_mutex_unlock( &heap->lock );
+  LATENCY_GROW_FLUSH();
+  if (addr) size_histogram_record_malloc( query, addr->capacity.bytes );
+  LATENCY_RECORD( LATENCY_MALLOC_PATH(), start, query );
   if (addr) return addr->contents;
   else return NULL;
 }
 
+void* heap_malloc( struct heap* heap, size_t query ) {
+  return heap_malloc_aligned( heap, BLOCK_ALIGN, query );
+}
+
+static void heap_init_from_config( void ) {
+  heap_init_with( mem_config.initial_size, mem_config.options );
+}
+
+/*  куча создаётся при первом обращении, поэтому _malloc можно звать и из глобальных конструкторов */
+static inline void heap_ensure_ready( void ) {
+  if (__builtin_expect( !atomic_load_explicit( &heap_ready, memory_order_acquire ), 0 ))
+    pthread_once( &heap_once, heap_init_from_config );
+}
+
+/*  Вырастить кучу так, чтобы в ней был свободный блок на bytes байт, и заранее загрузить его страницы.
+    Блок остаётся свободным: его получит ближайший _malloc подходящего размера. */
+bool heap_reserve( size_t bytes ) {
+  heap_ensure_ready();
+  struct heap* heap = &main_heap;
+  pthread_mutex_lock( &heap->lock );
+  bool reserved = false;
+  if (heap->start) {
+    struct block_search_result result = find_good_or_last( heap->start, bytes );
+    if (result.type == BSR_REACHED_END_NOT_FOUND) {
+      grow_heap( heap, result.block, bytes );
+      result = find_good_or_last( heap->start, bytes );
+    }
+    if (result.type == BSR_FOUND_GOOD_BLOCK) {
+      prefault_range( result.block->contents, bytes );
+      reserved = true;
+    }
+  }
+  pthread_mutex_unlock( &heap->lock );
+  return reserved;
+}
+
+/*  большие запросы (от mmap_threshold) не трогают список блоков: каждый получает своё отображение,
+    которое _free сразу возвращает ядру */
+static struct {
+  _Atomic size_t blocks, bytes, mallocs, frees;
+} mapped_blocks;
+
+static void* map_block( size_t query ) {
+  const size_t size = round_pages( size_from_capacity( (block_capacity) {query} ).bytes );
+  struct block_header* block = map_pages( NULL, size, 0 );
+  if (block == MAP_FAILED) return NULL;
+  atomic_fetch_add_explicit( &mapped_blocks.blocks, 1, memory_order_relaxed );
+  atomic_fetch_add_explicit( &mapped_blocks.bytes, size, memory_order_relaxed );
+  atomic_fetch_add_explicit( &mapped_blocks.mallocs, 1, memory_order_relaxed );
+  block_init( block, (block_size) {size}, NULL );
+  block->is_free = false;
+  block->is_mapped = true;
+  size_histogram_record_malloc( query, block->capacity.bytes );
+  return block->contents;
+}
+
+static void* main_malloc( size_t query ) {
+  heap_ensure_ready();
+  if (query > QUERY_MAX) return NULL;
+  if (mem_config.mmap_threshold && query >= mem_config.mmap_threshold) return map_block( query );
+  return heap_malloc( &main_heap, query );
+}
+
+void* _malloc( size_t query ) {
+  void* const mem = main_malloc( query );
+  TRACE_EVENT( TRACE_MALLOC, mem, NULL, query );
+  LEAK_SITE( mem, __builtin_return_address( 0 ) );
+  PROFILE_MALLOC( mem, query );
+  return mem;
+}
+
+/*  выровненные блоки всегда берутся из основной кучи, даже выше mmap_threshold */
+void* _malloc_aligned( size_t alignment, size_t query ) {
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) return NULL;
+  heap_ensure_ready();
+  void* const mem = heap_malloc_aligned( &main_heap, alignment, query );
+  TRACE_EVENT( TRACE_MALLOC, mem, NULL, query );
+  LEAK_SITE( mem, __builtin_return_address( 0 ) );
+  PROFILE_MALLOC( mem, query );
+  return mem;
+}
+
+/*  вернуть ядру целые страницы внутри свободного блока; отображение остаётся, и при следующем
+    обращении страницы вернутся обнулёнными */
+static void trim_block( struct block_header* block ) {
+  const uintptr_t page = getpagesize();
+  const uintptr_t begin = ((uintptr_t) block->contents + page - 1) & ~(page - 1);
+  const uintptr_t end = (uintptr_t) block_after( block ) & ~(page - 1);
+  if (end > begin) madvise( (void*) begin, end - begin, MADV_DONTNEED );
+}
+
+/*  последний блок кучи, ставший большим свободным, отдаёт страницы ядру (один раз, пока его не заняли) */
+static void trim_tail( struct heap* heap, struct block_header* last ) {
+  if (mem_config.trim_threshold && last->is_free && last->capacity.bytes >= mem_config.trim_threshold
+      && last != heap->trimmed) {
+    trim_block( last );
+    heap->trimmed = last;
+  }
+}
+
 struct block_header* block_get_header(void* contents) {
   return (struct block_header*) (((uint8_t*)contents)-offsetof(struct block_header, contents));
 }
 
-void _free( void* mem ) {
-  if (!mem) return ;
+static void release( void* mem ) {
+  LATENCY_START( start );
   struct block_header* header = block_get_header( mem );
+  size_histogram_record_free( header->capacity.bytes );
+  if (header->is_sampled) profile_forget( mem );
+  if (header->is_mapped) {
+    const size_t size = size_from_capacity( header->capacity ).bytes;
+    munmap( header, size );
+    atomic_fetch_sub_explicit( &mapped_blocks.blocks, 1, memory_order_relaxed );
+    atomic_fetch_sub_explicit( &mapped_blocks.bytes, size, memory_order_relaxed );
+    atomic_fetch_add_explicit( &mapped_blocks.frees, 1, memory_order_relaxed );
+    LATENCY_RECORD( LATENCY_FREE, start, size );
+    return;
+  }
+  struct heap* heap = heap_of( mem );
+  pthread_mutex_lock( &heap->lock );
+  heap_check_tick( heap );
   header->is_free = true;
+  stats_block_released( heap, header->capacity.bytes );
+  heap->stats.frees++;
 
   //-----------------------------------------------------------
+  struct block_header* last = header;
   while(header != NULL) {
-      try_merge_with_next(header);
+      try_merge_with_next(heap, header);
+      last = header;
       header = header -> next;
   }
   //-----------------------------------------------------------
+  trim_tail( heap, last );
+  pthread_mutex_unlock( &heap->lock );
+  LATENCY_RECORD( LATENCY_FREE, start, 0 );
+}
+
+/*  освобождение пишется в трассу до того, как блок вернётся в кучу: иначе его повторная выдача
+    другому потоку могла бы попасть в трассу раньше */
+void _free( void* mem ) {
+  if (!mem) return ;
+  TRACE_EVENT( TRACE_FREE, mem, NULL, 0 );
+  release( mem );
+}
+
+/*  Размер не заменяет заголовок: он стоит вплотную перед содержимым, и освобождение всё равно
+    помечает его свободным и сливает с соседями. Поэтому размер только сверяется в сборке с DEBUG,
+    а путь (отображение или куча) выбирается, как в _free */
+void _free_sized( void* mem, size_t size ) {
+  if (!mem) return;
+#ifdef DEBUG
+  struct block_header const* header = block_get_header( mem );
+  if (header->is_free || header->capacity.bytes < size)
+    err( "_free_sized: block %p of capacity %zu%s freed with size %zu\n", mem, header->capacity.bytes,
+         header->is_free ? " (already free)" : "", size );
+#else
+  (void) size;
+#endif
+  TRACE_EVENT( TRACE_FREE, mem, NULL, 0 );
+  release( mem );
+}
+
+/*  --- Пакетные выделение и освобождение --- */
+
+/*  разрезать занятый блок на count блоков вместимости capacity одним проходом от его начала;
+    лишний хвост последнего отделяется свободным блоком, как в shrink_taken */
+static void carve_taken( struct heap* heap, struct block_header* block, size_t capacity, size_t count, void** out ) {
+  for (size_t i = 0; i + 1 < count; i++) {
+    struct block_header* next = (struct block_header*) (block->contents + capacity);
+    block_init( next, (block_size) { block->capacity.bytes - capacity }, block->next );
+    next->is_free = false;
+    block->capacity.bytes = capacity;
+    block->next = next;
+    out[i] = block->contents;
+    block = next;
+  }
+  heap->stats.used_blocks += count - 1;
+  heap->stats.in_use_bytes -= (count - 1) * BLOCK_HEADER_SIZE;
+  heap->stats.header_bytes += (count - 1) * BLOCK_HEADER_SIZE;
+  shrink_taken( heap, block, capacity );
+  out[count - 1] = block->contents;
+}
+
+/*  место сразу под все блоки ищется одним проходом по списку; если сплошного места нет
+    (а вырасти куча не может), оставшиеся блоки выделяются по одному под тем же захватом мьютекса */
+static size_t heap_malloc_batch( struct heap* heap, size_t query, size_t count, void** out ) {
+  const size_t capacity = round_capacity( query );
+  size_t done = 0, total;
+  pthread_mutex_lock( &heap->lock );
+  heap_check_tick( heap );
+  if (!__builtin_mul_overflow( count, capacity + BLOCK_HEADER_SIZE, &total ) && total - BLOCK_HEADER_SIZE <= QUERY_MAX) {
+    struct block_header* const block = memalloc( total - BLOCK_HEADER_SIZE, heap );
+    if (block) {
+      carve_taken( heap, block, capacity, count, out );
+      done = count;
+    }
+  }
+  for (struct block_header* block; done < count && (block = memalloc( capacity, heap )); done++)
+    out[done] = block->contents;
+  heap->trimmed = NULL;
+  heap->stats.mallocs += done;
+  pthread_mutex_unlock( &heap->lock );
+  LATENCY_GROW_FLUSH();
+  for (size_t i = 0; i < done; i++) size_histogram_record_malloc( query, block_get_header( out[i] )->capacity.bytes );
+  return done;
+}
+
+size_t _malloc_batch( size_t query, size_t count, void** out ) {
+  heap_ensure_ready();
+  if (count == 0 || query > QUERY_MAX) return 0;
+  size_t done = 0;
+  if (mem_config.mmap_threshold && query >= mem_config.mmap_threshold) {
+    while (done < count && (out[done] = map_block( query ))) done++;
+  } else {
+    done = heap_malloc_batch( &main_heap, query, count, out );
+  }
+  for (size_t i = 0; i < done; i++) {
+    TRACE_EVENT( TRACE_MALLOC, out[i], NULL, query );
+    LEAK_SITE( out[i], __builtin_return_address( 0 ) );
+    PROFILE_MALLOC( out[i], query );
+  }
+  return done;
+}
+
+static int compare_addresses( const void* a, const void* b ) {
+  const uintptr_t x = (uintptr_t) *(void* const*) a, y = (uintptr_t) *(void* const*) b;
+  return x < y ? -1 : x > y;
+}
+
+/*  блоки одной кучи по возрастанию адресов: все помечаются свободными, затем один проход
+    от первого из них сливает каждый свободный блок со всеми свободными соседями за ним.
+    Проход заканчивается на участке, поглотившем последний из блоков: дальше по списку
+    освобождённых блоков нет, а хвост обрезается, только если этот участок -- конец списка */
+static void heap_free_sorted( struct heap* heap, void* const* mems, size_t count ) {
+  pthread_mutex_lock( &heap->lock );
+  heap_check_tick( heap );
+  for (size_t i = 0; i < count; i++) {
+    struct block_header* header = block_get_header( mems[i] );
+    header->is_free = true;
+    stats_block_released( heap, header->capacity.bytes );
+  }
+  heap->stats.frees += count;
+
+  uint8_t const* const highest = (uint8_t const*) block_get_header( mems[count - 1] );
+  struct block_header* b = block_get_header( mems[0] );
+  for (;; b = b->next) {
+    while (try_merge_with_next( heap, b )) {}
+    if (!b->next || (highest >= (uint8_t const*) b && highest < (uint8_t const*) block_after( b ))) break;
+  }
+  if (!b->next) trim_tail( heap, b );
+  pthread_mutex_unlock( &heap->lock );
+}
+
+/*  массив переупорядочивается: блоки сортируются по адресу, подряд идущие блоки одной кучи
+    освобождаются одним захватом её мьютекса */
+void _free_batch( void** mems, size_t count ) {
+  qsort( mems, count, sizeof( void* ), compare_addresses );
+  for (size_t i = 0; i < count;) {
+    if (!mems[i]) { i++; continue; }
+    if (block_get_header( mems[i] )->is_mapped) { _free( mems[i++] ); continue; }
+    struct heap* const heap = heap_of( mems[i] );
+    size_t run = 0;
+    for (; i + run < count; run++) {
+      struct block_header* header = block_get_header( mems[i + run] );
+      if (header->is_mapped || heap_of( mems[i + run] ) != heap) break;
+      TRACE_EVENT( TRACE_FREE, mems[i + run], NULL, 0 );
+      size_histogram_record_free( header->capacity.bytes );
+      if (header->is_sampled) profile_forget( mems[i + run] );
+    }
+    heap_free_sorted( heap, mems + i, run );
+    i += run;
+  }
+}
+
+/*  --- Изменение размера блока --- */
+
+/*  Изменить вместимость занятого блока на месте: при росте поглотить идущие за ним вплотную
+    свободные блоки, а лишний хвост (если он не меньше split_threshold) снова отделить свободным блоком. */
+static bool resize_in_place( struct heap* heap, struct block_header* block, size_t query ) {
+  query = round_capacity( query );
+
+  size_t available = block->capacity.bytes;
+  struct block_header const* prev = block;
+  for (struct block_header* n = block->next; available < query && n && n->is_free && blocks_continuous( prev, n ); n = n->next) {
+    available += size_from_capacity( n->capacity ).bytes;
+    prev = n;
+  }
+  if (available < query) return false;
+
+  while (block->capacity.bytes < query) {
+    struct block_header* next = block->next;
+    stats_free_shrank( heap, next->capacity.bytes );
+    heap->stats.free_blocks--;
+    heap->stats.free_bytes -= next->capacity.bytes;
+    heap->stats.header_bytes -= BLOCK_HEADER_SIZE;
+    heap->stats.in_use_bytes += size_from_capacity( next->capacity ).bytes;
+    block->capacity.bytes += size_from_capacity( next->capacity ).bytes;
+    block->next = next->next;
+  }
+  shrink_taken( heap, block, query );
+  heap->trimmed = NULL;
+  return true;
+}
+
+/*  отделить лишний хвост занятого блока свободным блоком, если он не меньше split_threshold */
+static void shrink_taken( struct heap* heap, struct block_header* block, size_t query ) {
+  if (block->capacity.bytes >= query + BLOCK_HEADER_SIZE + mem_config.split_threshold) {
+    const block_size rest = { block->capacity.bytes - query };
+    block->capacity.bytes = query;
+    struct block_header* tail = block_after( block );
+    block_init( tail, rest, block->next );
+    block->next = tail;
+    heap->stats.in_use_bytes -= rest.bytes;
+    heap->stats.free_blocks++;
+    heap->stats.header_bytes += BLOCK_HEADER_SIZE;
+    heap->stats.free_bytes += tail->capacity.bytes;
+    stats_free_grew( heap, tail->capacity.bytes );
+    try_merge_with_next( heap, tail );
+  }
+}
+
+static void* realloc_traced( void* moved, void* mem, size_t query ) {
+  TRACE_EVENT( TRACE_REALLOC, moved, mem, query );
+  return moved;
+}
+
+/*  событие трассы пишется до освобождения старого блока, как в _free */
+static void* reallocate( void* mem, size_t query ) {
+  if (!mem) return realloc_traced( main_malloc( query ), NULL, query );
+  if (query == 0) {
+    TRACE_EVENT( TRACE_REALLOC, NULL, mem, 0 );
+    release( mem );
+    return NULL;
+  }
+  if (query > QUERY_MAX) return realloc_traced( NULL, mem, query );
+
+  struct block_header* block = block_get_header( mem );
+  const size_t old_capacity = block->capacity.bytes;
+  struct heap* heap = NULL;
+  if (block->is_mapped) {
+    if (old_capacity >= query) return realloc_traced( mem, mem, query );
+  } else {
+    heap = heap_of( mem );
+    pthread_mutex_lock( &heap->lock );
+    const bool resized = resize_in_place( heap, block, query );
+    pthread_mutex_unlock( &heap->lock );
+    if (resized) {
+      size_histogram_record_resize( old_capacity, block->capacity.bytes );
+      return realloc_traced( mem, mem, query );
+    }
+  }
+
+  void* moved = (heap == NULL || heap == &main_heap) ? main_malloc( query ) : heap_malloc( heap, query );
+  if (!moved) return realloc_traced( NULL, mem, query );
+  memcpy( moved, mem, old_capacity < query ? old_capacity : query );
+  TRACE_EVENT( TRACE_REALLOC, moved, mem, query );
+  release( mem );
+  return moved;
+}
+
+void* _realloc( void* mem, size_t query ) {
+  void* const moved = reallocate( mem, query );
+  LEAK_SITE( moved, __builtin_return_address( 0 ) );
+  /*  блок, оставшийся на месте, сохраняет выборку с прежним размером */
+  if (moved != mem) PROFILE_MALLOC( moved, query );
+  return moved;
+}
+
+static void heap_stats_add( struct heap_stats* total, struct heap* heap ) {
+  pthread_mutex_lock( &heap->lock );
+  if (heap->largest_free_stale) {
+    heap->stats.largest_free = 0;
+    for (struct block_header const* b = heap->start; b; b = b->next)
+      if (b->is_free && b->capacity.bytes > heap->stats.largest_free) heap->stats.largest_free = b->capacity.bytes;
+    heap->largest_free_stale = false;
+  }
+  const struct heap_stats s = heap->stats;
+  pthread_mutex_unlock( &heap->lock );
+
+  total->mapped_bytes += s.mapped_bytes;
+  total->in_use_bytes += s.in_use_bytes;
+  total->free_bytes += s.free_bytes;
+  total->header_bytes += s.header_bytes;
+  total->used_blocks += s.used_blocks;
+  total->free_blocks += s.free_blocks;
+  total->regions += s.regions;
+  total->largest_free = size_max( total->largest_free, s.largest_free );
+  total->mallocs += s.mallocs;
+  total->frees += s.frees;
+  total->grows += s.grows;
+}
+
+void heap_for_each( void (*visit)( struct heap* heap, void* arg ), void* arg ) {
+  struct heap* all[HEAPS_MAX + 1] = { &main_heap };
+  const size_t count = atomic_load_explicit( &heaps_count, memory_order_acquire );
+  for (size_t i = 0; i < count; i++) all[i + 1] = heaps[i];
+  for (size_t i = 0; i <= count; i++) {
+    pthread_mutex_lock( &all[i]->lock );
+    visit( all[i], arg );
+    pthread_mutex_unlock( &all[i]->lock );
+  }
+}
+
+/*  все кучи под мьютексами разом (вокруг fork); порядок всегда один и тот же */
+void heap_lock_all( void ) {
+  pthread_mutex_lock( &main_heap.lock );
+  const size_t count = atomic_load_explicit( &heaps_count, memory_order_acquire );
+  for (size_t i = 0; i < count; i++) pthread_mutex_lock( &heaps[i]->lock );
+}
+
+void heap_unlock_all( void ) {
+  const size_t count = atomic_load_explicit( &heaps_count, memory_order_acquire );
+  for (size_t i = count; i > 0; i--) pthread_mutex_unlock( &heaps[i - 1]->lock );
+  pthread_mutex_unlock( &main_heap.lock );
+}
+
+struct heap_stats heap_stats( void ) {
+  struct heap_stats total = {0};
+  heap_stats_add( &total, &main_heap );
+  const size_t count = atomic_load_explicit( &heaps_count, memory_order_acquire );
+  for (size_t i = 0; i < count; i++) heap_stats_add( &total, heaps[i] );
+
+  total.mmapped_blocks = atomic_load_explicit( &mapped_blocks.blocks, memory_order_relaxed );
+  total.mmapped_bytes = atomic_load_explicit( &mapped_blocks.bytes, memory_order_relaxed );
+  total.mapped_bytes += total.mmapped_bytes;
+  total.mallocs += atomic_load_explicit( &mapped_blocks.mallocs, memory_order_relaxed );
+  total.frees += atomic_load_explicit( &mapped_blocks.frees, memory_order_relaxed );
+  return total;
 }
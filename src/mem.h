@@ -9,12 +9,144 @@
 
 #include <sys/mman.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define HEAP_START ((void*)0x04040000)
 
 void* _malloc( size_t query );
 void  _free( void* mem );
+/*  _free для блока, размер которого известен вызывающему (не больше запрошенного при выделении);
+    в сборке с DEBUG размер сверяется с заголовком блока. Заголовок читается и здесь: путь
+    (отображение или куча) и вместимость берутся из него, как в _free, а размер путь не выбирает.
+    Без чтения заголовка (класс по размеру) освобождает только tcache_free_sized для блоков tcache_malloc */
+#define MEM_HAS_FREE_SIZED 1
+void  _free_sized( void* mem, size_t size );
+/*  count блоков по query байт в out, вырезанных по возможности из одного свободного места;
+    возвращает, сколько блоков выделено (меньше count -- память кончилась) */
+size_t _malloc_batch( size_t query, size_t count, void** out );
+/*  освободить count блоков (NULL пропускаются); mems сортируется по адресу, соседние блоки
+    сливаются за один проход по куче */
+void  _free_batch( void** mems, size_t count );
+void* _realloc( void* mem, size_t query );
+/*  блок, содержимое которого выровнено на alignment (степень двойки); остальные выровнены
+    на 16 байт. Освобождается обычным _free */
+void* _malloc_aligned( size_t alignment, size_t query );
 void* heap_init( size_t initial_size );
 
+/*  prefault: загружать страницы каждого нового региона сразу при heap_init и grow_heap */
+struct heap_options {
+  bool prefault;
+};
+
+void* heap_init_with( size_t initial_size, struct heap_options options );
+bool  heap_reserve( size_t bytes );
+
+/*  Статистика куч, которая поддерживается по ходу работы, а не обходом списка блоков.
+    mapped_bytes = in_use_bytes + free_bytes + header_bytes + mmapped_bytes */
+struct heap_stats {
+  size_t mapped_bytes;
+  size_t in_use_bytes;
+  size_t free_bytes;
+  size_t header_bytes;
+  size_t used_blocks;
+  size_t free_blocks;
+  size_t regions;
+  size_t largest_free;
+  size_t mmapped_blocks;
+  size_t mmapped_bytes;
+  size_t mallocs;
+  size_t frees;
+  size_t grows;
+};
+
+/*  сумма по основной куче, NUMA-аренам и блокам с отдельным отображением */
+struct heap_stats heap_stats( void );
+/*  статистика и гистограмма размеров в текстовом виде "имя значение" по строке на счётчик */
+void heap_stats_print( FILE* f );
+
+/*  Записать в fd живые блоки из выборки профиля (profile_rate) в свёрнутом формате для flamegraph:
+    "корень;...;место_выделения байты" по строке на стек, байты -- оценка по выборке.
+    Не выделяет память из кучи; false при ошибке записи. */
+bool heap_profile_dump( int fd );
+
+/*  Занятые блоки куч, сгруппированные по месту выделения и отсортированные по байтам.
+    Места известны только в сборке с MEM_LEAK_SITES (make LEAK_SITES=1), тогда же отчёт
+    печатается в stderr при выходе; без неё все блоки попадают в одну строку "[unknown]".
+    Блоки в кэше вызывающего потока и в депо (tcache.h) вместе с магазинами утечками не считаются
+    и идут отдельной строкой; отчёт их не освобождает (для этого есть tcache_flush и
+    tcache_depot_release). Магазины других потоков видны как занятые блоки.
+    Возвращает число занятых блоков в списках куч без кэшированных (блоки с отдельным отображением
+    идут одной строкой). */
+size_t heap_leak_report( FILE* f );
+
+/*  Машиночитаемый дамп куч в fd: строка на блок (куча, непрерывный регион, адрес заголовка,
+    вместимость, свободен ли), затем сводки по всем блокам независимо от фильтра --
+    гистограмма свободных блоков по размерам, занятость каждого региона и наибольшая цепочка
+    соседних свободных блоков. Каждая запись начинается с её типа: в CSV это первый столбец
+    (имена столбцов -- в строке "#тип,..." перед секцией), в JSON Lines -- поле "record".
+    Блоки с отдельным отображением в списки куч не входят и в дамп не попадают.
+    Не выделяет память из кучи; false при ошибке записи. */
+enum heap_dump_format { HEAP_DUMP_CSV, HEAP_DUMP_JSONL };
+
+/*  from и to ограничивают адреса заголовков полуинтервалом [from, to); NULL -- без границы */
+struct heap_dump_filter {
+  bool        free_only;
+  size_t      min_capacity;
+  void const* from;
+  void const* to;
+};
+
+/*  filter == NULL -- все блоки */
+bool heap_dump( int fd, enum heap_dump_format format, struct heap_dump_filter const* filter );
+
+/*  Компактный бинарный снимок списков блоков (формат -- в snapshot.h) для сравнения утилитой
+    snapshot_diff: адрес, вместимость, свободен ли и, в сборке с MEM_LEAK_SITES, место выделения.
+    Каждая куча копируется под своим мьютексом одним проходом, весь снимок пишется одним write.
+    Не выделяет память из кучи; false при ошибке записи. */
+bool heap_snapshot( int fd );
+
+/*  Проверка целостности куч: next каждого блока указывает в известный регион и совпадает
+    с block_after (или переходит к следующему, не примыкающему региону ровно на его границе),
+    блоки без зазоров покрывают регионы, а счётчики блоков сходятся со списком.
+    Соседние свободные блоки -- не порча: _free сливает блок только со следующими, поэтому
+    такие пары только считаются. Обход кучи останавливается на первом нарушении.
+    Непрерывный режим -- параметр check_interval (MEM_CONF или _mallopt). */
+struct heap_check_report {
+  size_t      heaps;
+  size_t      regions;
+  size_t      blocks;
+  size_t      uncoalesced;
+  size_t      errors;
+  /*  кучи, для которых таблица регионов неполна и проверка невозможна */
+  size_t      skipped;
+  /*  первое нарушение: заголовок, у которого оно найдено, и описание */
+  void const* bad_block;
+  const char* problem;
+};
+
+struct heap_check_report heap_check( void );
+
+/*  параметры _mallopt; их смысл описан в config.h */
+enum mem_option {
+  MEM_OPT_HEAP_SIZE,
+  MEM_OPT_HEAP_START,
+  MEM_OPT_PREFAULT,
+  MEM_OPT_REGION_MIN,
+  MEM_OPT_GROWTH_FACTOR,
+  MEM_OPT_MMAP_THRESHOLD,
+  MEM_OPT_TRIM_THRESHOLD,
+  MEM_OPT_SPLIT_THRESHOLD,
+  MEM_OPT_CACHE_SIZE,
+  MEM_OPT_DEBUG,
+  MEM_OPT_PROFILE_RATE,
+  MEM_OPT_CHECK_INTERVAL
+};
+
+/*  возвращает 1, если параметр принят, и 0 для неизвестного параметра или недопустимого значения */
+int _mallopt( int param, size_t value );
+
 #define DEBUG_FIRST_BYTES 4
 
 void debug_struct_info( FILE* f, void const* address );
@@ -23,4 +155,8 @@ struct block_header * block_get_header(void * contents);
 void* block_after( struct block_header const* block );
 void* map_pages(void const* addr, size_t length, int additional_flags);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
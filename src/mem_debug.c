@@ -1,7 +1,13 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include "config.h"
 #include "mem_internals.h"
 #include "mem.h"
+#include "sizehist.h"
+#include "tcache.h"
 
 void debug_struct_info( FILE* f,
                                  void const* addr ) {
@@ -28,6 +34,7 @@ void debug_heap( FILE* f,  void const* ptr ) {
 
 void debug_block(struct block_header* b, const char* fmt, ... ) {
   #ifdef DEBUG
+  if (!mem_config.debug) return;
 
   va_list args;
   va_start (args, fmt);
@@ -43,6 +50,7 @@ void debug_block(struct block_header* b, const char* fmt, ... ) {
 
 void debug(const char* fmt, ... ) {
 #ifdef DEBUG
+  if (!mem_config.debug) return;
 
   va_list args;
   va_start (args, fmt);
@@ -53,3 +61,171 @@ void debug(const char* fmt, ... ) {
   (void) fmt;
 #endif
 }
+
+void heap_stats_print( FILE* f ) {
+  const struct heap_stats s = heap_stats();
+  fprintf( f, "mapped_bytes %zu\nin_use_bytes %zu\nfree_bytes %zu\nheader_bytes %zu\n",
+           s.mapped_bytes, s.in_use_bytes, s.free_bytes, s.header_bytes );
+  fprintf( f, "used_blocks %zu\nfree_blocks %zu\nregions %zu\nlargest_free %zu\n",
+           s.used_blocks, s.free_blocks, s.regions, s.largest_free );
+  fprintf( f, "mmapped_blocks %zu\nmmapped_bytes %zu\nmallocs %zu\nfrees %zu\ngrows %zu\n",
+           s.mmapped_blocks, s.mmapped_bytes, s.mallocs, s.frees, s.grows );
+
+  /*  size -- нижняя граница корзины запрошенного размера, capacity -- вместимости блока */
+  static struct size_bucket requests[SIZE_BUCKETS];
+  static int64_t live[SIZE_BUCKETS];
+  size_histogram_get( requests, live );
+  for (size_t i = 0; i < SIZE_BUCKETS; i++) {
+    const size_t lower = size_bucket_lower( i );
+    if (requests[i].allocs) {
+      fprintf( f, "size_allocs{size=\"%zu\"} %" PRIu64 "\n", lower, requests[i].allocs );
+      fprintf( f, "size_bytes{size=\"%zu\"} %" PRIu64 "\n", lower, requests[i].bytes );
+    }
+    if (live[i]) fprintf( f, "capacity_live{capacity=\"%zu\"} %" PRId64 "\n", lower, live[i] );
+  }
+}
+
+/*  --- Отчёт об утечках ---
+    Места собираются в таблицу с открытой адресацией в отдельном отображении: отчёт печатается
+    при выходе, когда куча может быть в любом состоянии, и не должен сам выделять из неё память. */
+
+#define LEAK_SITES_MAX 4096
+
+struct leak_site {
+  void const* site;
+  size_t      blocks;
+  size_t      bytes;
+};
+
+/*  содержимое блоков, лежащих в кэше потока (tcache_for_each_cached): это не утечки */
+struct cached_set {
+  void const** slots;
+  size_t       mask;
+};
+
+struct leak_table {
+  struct leak_site* sites;
+  size_t            count;
+  size_t            overflow_blocks, overflow_bytes;
+  struct cached_set cached;
+  size_t            cached_blocks, cached_bytes;
+};
+
+static void const* block_site( struct block_header const* b ) {
+#ifdef MEM_LEAK_SITES
+  return b->site;
+#else
+  (void) b;
+  return NULL;
+#endif
+}
+
+static void leak_add( struct leak_table* t, void const* site, size_t bytes ) {
+  size_t i = (size_t) (((uintptr_t) site >> 2) * 0x9E3779B97F4A7C15ull) % LEAK_SITES_MAX;
+  for (size_t probes = 0; probes < LEAK_SITES_MAX; probes++, i = (i + 1) % LEAK_SITES_MAX) {
+    struct leak_site* s = &t->sites[i];
+    if (s->blocks == 0) { s->site = site; t->count++; }
+    if (s->site == site) { s->blocks++; s->bytes += bytes; return; }
+  }
+  t->overflow_blocks++;
+  t->overflow_bytes += bytes;
+}
+
+static size_t cached_slot( void const* mem ) { return (size_t) (((uintptr_t) mem >> 4) * 0x9E3779B97F4A7C15ull); }
+
+static void cached_count( void* mem, void* arg ) {
+  (void) mem;
+  (*(size_t*) arg)++;
+}
+
+/*  таблица вдвое больше числа блоков при подсчёте; если кэш успел вырасти, лишние блоки не запоминаются */
+static void cached_add( void* mem, void* arg ) {
+  struct cached_set* set = arg;
+  for (size_t i = cached_slot( mem ) & set->mask, probes = 0; probes <= set->mask / 2; i = (i + 1) & set->mask, probes++)
+    if (!set->slots[i] || set->slots[i] == mem) { set->slots[i] = mem; return; }
+}
+
+static bool cached_contains( struct cached_set const* set, void const* mem ) {
+  for (size_t i = cached_slot( mem ) & set->mask; set->slots[i]; i = (i + 1) & set->mask)
+    if (set->slots[i] == mem) return true;
+  return false;
+}
+
+static void leak_collect( struct heap* heap, void* arg ) {
+  struct leak_table* t = arg;
+  for (struct block_header const* b = heap->start; b; b = b->next) {
+    if (b->is_free) continue;
+    if (cached_contains( &t->cached, b->contents )) {
+      t->cached_blocks++;
+      t->cached_bytes += b->capacity.bytes;
+    } else leak_add( t, block_site( b ), b->capacity.bytes );
+  }
+}
+
+static int leak_compare( const void* a, const void* b ) {
+  struct leak_site const* x = a;
+  struct leak_site const* y = b;
+  if (x->bytes != y->bytes) return x->bytes > y->bytes ? -1 : 1;
+  return (x->blocks < y->blocks) - (x->blocks > y->blocks);
+}
+
+static void leak_print_site( FILE* f, void const* site ) {
+  Dl_info info;
+  if (!site) fprintf( f, "[unknown]\n" );
+  else if (dladdr( site, &info ) && info.dli_sname)
+    fprintf( f, "%s+0x%zx\n", info.dli_sname, (size_t) ((uintptr_t) site - (uintptr_t) info.dli_saddr) );
+  else fprintf( f, "%p\n", site );
+}
+
+/*  quiet -- ничего не печатать, если утечек нет (отчёт при выходе) */
+static size_t leak_report( FILE* f, bool quiet ) {
+  struct leak_table t = { .sites = map_pages( NULL, LEAK_SITES_MAX * sizeof( struct leak_site ), 0 ) };
+  if (t.sites == MAP_FAILED) return 0;
+  size_t cached = 0;
+  tcache_for_each_cached( cached_count, &cached );
+  size_t capacity = 64;
+  while (capacity < 2 * cached) capacity <<= 1;
+  t.cached = (struct cached_set) { map_pages( NULL, capacity * sizeof( void* ), 0 ), capacity - 1 };
+  if (t.cached.slots == MAP_FAILED) {
+    munmap( t.sites, LEAK_SITES_MAX * sizeof( struct leak_site ) );
+    return 0;
+  }
+  tcache_for_each_cached( cached_add, &t.cached );
+  heap_for_each( leak_collect, &t );
+  munmap( t.cached.slots, capacity * sizeof( void* ) );
+
+  /*  занятые ячейки сдвигаются в начало, после чего таблица -- обычный массив */
+  size_t used = 0, blocks = t.overflow_blocks, bytes = t.overflow_bytes;
+  for (size_t i = 0; i < LEAK_SITES_MAX; i++)
+    if (t.sites[i].blocks) {
+      blocks += t.sites[i].blocks;
+      bytes += t.sites[i].bytes;
+      t.sites[used++] = t.sites[i];
+    }
+  qsort( t.sites, used, sizeof( struct leak_site ), leak_compare );
+  const struct heap_stats s = heap_stats();
+  if (quiet && blocks == 0 && s.mmapped_blocks == 0) {
+    munmap( t.sites, LEAK_SITES_MAX * sizeof( struct leak_site ) );
+    return 0;
+  }
+
+  fprintf( f, " --- Leaks: %zu blocks, %zu bytes ---\n", blocks, bytes );
+  fprintf( f, "%12s %8s  %s\n", "bytes", "blocks", "site" );
+  for (size_t i = 0; i < used; i++) {
+    fprintf( f, "%12zu %8zu  ", t.sites[i].bytes, t.sites[i].blocks );
+    leak_print_site( f, t.sites[i].site );
+  }
+  if (t.overflow_blocks)
+    fprintf( f, "%12zu %8zu  [other sites]\n", t.overflow_bytes, t.overflow_blocks );
+  if (s.mmapped_blocks)
+    fprintf( f, "%12zu %8zu  [mmapped, sites not tracked]\n", s.mmapped_bytes, s.mmapped_blocks );
+  if (t.cached_blocks)
+    fprintf( f, "%12zu %8zu  [cached in tcache, not counted]\n", t.cached_bytes, t.cached_blocks );
+
+  munmap( t.sites, LEAK_SITES_MAX * sizeof( struct leak_site ) );
+  return blocks;
+}
+
+size_t heap_leak_report( FILE* f ) { return leak_report( f, false ); }
+
+void heap_leak_report_at_exit( void ) { leak_report( stderr, true ); }
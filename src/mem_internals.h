@@ -4,8 +4,17 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <pthread.h>
+
+#include "mem.h"
 
 #define REGION_MIN_SIZE (2 * 4096)
+/*  предел, до которого growth_factor увеличивает очередной регион */
+#define REGION_GROWTH_MAX ((size_t) 1 << 30)
+#define BLOCK_MIN_CAPACITY 32
+/*  содержимое блоков выровнено как max_align_t: заголовок дополняется до BLOCK_ALIGN,
+    а вместимости кратны BLOCK_ALIGN, поэтому следующий заголовок тоже выровнен */
+#define BLOCK_ALIGN 16
 
 struct region { void* addr; size_t size; bool extends; };
 static const struct region REGION_INVALID = {0};
@@ -15,14 +24,64 @@ inline bool region_is_invalid( const struct region* r ) { return r->addr == NULL
 typedef struct { size_t bytes; } block_capacity;
 typedef struct { size_t bytes; } block_size;
 
+/*  site -- адрес возврата из _malloc/_realloc, выдавших блок; есть только в сборке с MEM_LEAK_SITES
+    (make LEAK_SITES=1), иначе заголовок не растёт */
 struct block_header {
   struct block_header*    next;
   block_capacity capacity;
+#ifdef MEM_LEAK_SITES
+  void const*    site;
+#endif
   bool           is_free;
-  uint8_t        contents[];
+  bool           is_mapped;
+  bool           is_sampled;
+  _Alignas( BLOCK_ALIGN ) uint8_t contents[];
 };
 
 inline block_size size_from_capacity( block_capacity cap ) { return (block_size) {cap.bytes + offsetof( struct block_header, contents ) }; }
 inline block_capacity capacity_from_size( block_size sz ) { return (block_capacity) {sz.bytes - offsetof( struct block_header, contents ) }; }
 
+/*  Куча: список блоков, начинающийся со start, и мьютекс, под которым с ним работают.
+    Если задан span_end, куча растёт только внутри окна [span_begin, span_end),
+    а on_region вызывается для каждого нового региона до первого обращения к нему
+    (например, чтобы привязать его к узлу NUMA).
+    regions -- отображённые регионы по возрастанию адресов, отдельно от списка блоков: по ним
+    heap_check узнаёт, куда вправе указывать next. Если таблицу не удалось расширить, regions_lost. */
+struct heap {
+  struct block_header* start;
+  pthread_mutex_t      lock;
+  void const*          span_begin;
+  void const*          span_end;
+  void               (*on_region)( struct heap* heap, void* addr, size_t size );
+  void*                data;
+  struct heap_options  options;
+  size_t               last_region_size;
+  struct block_header* trimmed;
+  struct heap_stats    stats;
+  bool                 largest_free_stale;
+  struct region*       regions;
+  size_t               regions_count, regions_capacity;
+  bool                 regions_lost;
+  size_t               check_ops, check_next;
+};
+
+void* heap_create( struct heap* heap, size_t initial );
+void* heap_malloc( struct heap* heap, size_t query );
+
+/*  вызвать visit для основной кучи и всех NUMA-арен, каждый раз под мьютексом этой кучи */
+void  heap_for_each( void (*visit)( struct heap* heap, void* arg ), void* arg );
+
+/*  взять и отпустить мьютексы всех куч, например вокруг fork */
+void  heap_lock_all( void );
+void  heap_unlock_all( void );
+
+/*  выборочная проверка (check_interval): префикс списка до очередного региона по кругу;
+    при порче печатает отчёт и завершает процесс. Вызывается под мьютексом кучи. */
+void  heap_check_sampled( struct heap* heap );
+/*  основная куча уже создана (после этого устройство кучи в mem_config не меняется) */
+bool  heap_is_ready( void );
+
+/*  отчёт об утечках в stderr при выходе (регистрируется в сборке с MEM_LEAK_SITES) */
+void  heap_leak_report_at_exit( void );
+
 #endif
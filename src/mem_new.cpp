@@ -0,0 +1,78 @@
+#include <cstddef>
+#include <new>
+
+#include "mem.h"
+#include "mem_pmr.hpp"
+#include "tcache.h"
+
+/*  Замена глобальных operator new/delete: объект этого файла подключается к программе при
+    компоновке, и все new/delete программы идут в кучу через кэш потока.
+
+      new, new[]                -- tcache_malloc; при нехватке памяти вызывается new_handler,
+                                   без него -- std::bad_alloc (варианты с nothrow -- nullptr);
+      new с align_val_t         -- выравнивание больше 16 байт через _malloc_aligned;
+      delete с размером         -- tcache_free_sized: класс считается по размеру, заголовок
+                                   блока не читается;
+      delete без размера        -- tcache_free, класс по вместимости из заголовка;
+      delete с align_val_t      -- _free (выровненные блоки в кэш потока не попадают).
+
+    Размер, который компилятор передаёт в delete, равен размеру из new, поэтому sized delete
+    верен только для блоков, выделенных этими же operator new. */
+
+namespace {
+
+void* allocate( std::size_t size, std::size_t alignment ) noexcept {
+  return alignment <= mem::block_alignment ? tcache_malloc( size ) : _malloc_aligned( alignment, size );
+}
+
+/*  повторять, пока new_handler освобождает память */
+void* allocate_or_throw( std::size_t size, std::size_t alignment ) {
+  for (;;) {
+    if (void* p = allocate( size, alignment )) return p;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) throw std::bad_alloc();
+    handler();
+  }
+}
+
+void* allocate_nothrow( std::size_t size, std::size_t alignment ) noexcept {
+  try {
+    return allocate_or_throw( size, alignment );
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+}  // namespace
+
+void* operator new( std::size_t size ) { return allocate_or_throw( size, mem::block_alignment ); }
+void* operator new[]( std::size_t size ) { return allocate_or_throw( size, mem::block_alignment ); }
+void* operator new( std::size_t size, std::nothrow_t const& ) noexcept { return allocate_nothrow( size, mem::block_alignment ); }
+void* operator new[]( std::size_t size, std::nothrow_t const& ) noexcept { return allocate_nothrow( size, mem::block_alignment ); }
+
+void* operator new( std::size_t size, std::align_val_t alignment ) {
+  return allocate_or_throw( size, static_cast<std::size_t>( alignment ) );
+}
+void* operator new[]( std::size_t size, std::align_val_t alignment ) {
+  return allocate_or_throw( size, static_cast<std::size_t>( alignment ) );
+}
+void* operator new( std::size_t size, std::align_val_t alignment, std::nothrow_t const& ) noexcept {
+  return allocate_nothrow( size, static_cast<std::size_t>( alignment ) );
+}
+void* operator new[]( std::size_t size, std::align_val_t alignment, std::nothrow_t const& ) noexcept {
+  return allocate_nothrow( size, static_cast<std::size_t>( alignment ) );
+}
+
+void operator delete( void* p ) noexcept { tcache_free( p ); }
+void operator delete[]( void* p ) noexcept { tcache_free( p ); }
+void operator delete( void* p, std::nothrow_t const& ) noexcept { tcache_free( p ); }
+void operator delete[]( void* p, std::nothrow_t const& ) noexcept { tcache_free( p ); }
+void operator delete( void* p, std::size_t size ) noexcept { tcache_free_sized( p, size ); }
+void operator delete[]( void* p, std::size_t size ) noexcept { tcache_free_sized( p, size ); }
+
+void operator delete( void* p, std::align_val_t ) noexcept { _free( p ); }
+void operator delete[]( void* p, std::align_val_t ) noexcept { _free( p ); }
+void operator delete( void* p, std::align_val_t, std::nothrow_t const& ) noexcept { _free( p ); }
+void operator delete[]( void* p, std::align_val_t, std::nothrow_t const& ) noexcept { _free( p ); }
+void operator delete( void* p, std::size_t, std::align_val_t ) noexcept { _free( p ); }
+void operator delete[]( void* p, std::size_t, std::align_val_t ) noexcept { _free( p ); }
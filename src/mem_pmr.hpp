@@ -0,0 +1,98 @@
+#ifndef _MEM_PMR_HPP_
+#define _MEM_PMR_HPP_
+
+/*  C++17-обёртки над аллокатором, только заголовок: подключается туда, где нужны отдельные контейнеры
+    на этой куче без замены глобального operator new.
+
+      mem::heap_resource  -- std::pmr::memory_resource поверх _malloc/_free или другого источника
+                             блоков той же кучи (например numa_malloc);
+      mem::allocator<T>   -- allocator без состояния для обычных контейнеров std.
+
+    Выравнивание до 16 байт дают все блоки кучи, большее берётся через _malloc_aligned (всегда
+    из основной кучи). При освобождении размер известен, поэтому, если собранный аллокатор
+    поддерживает освобождение с размером (MEM_HAS_FREE_SIZED), используется _free_sized. */
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "mem.h"
+
+namespace mem {
+
+inline constexpr std::size_t block_alignment = 16;
+
+inline void* allocate_bytes( std::size_t bytes, std::size_t alignment, void* (*source)( std::size_t ) = &_malloc ) {
+  void* p = alignment <= block_alignment ? source( bytes ) : _malloc_aligned( alignment, bytes );
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+inline void deallocate_bytes( void* p, std::size_t bytes, std::size_t alignment ) noexcept {
+#ifdef MEM_HAS_FREE_SIZED
+  if (alignment <= block_alignment) {
+    _free_sized( p, bytes );
+    return;
+  }
+#endif
+  (void) bytes;
+  (void) alignment;
+  _free( p );
+}
+
+class heap_resource final : public std::pmr::memory_resource {
+public:
+  using source_function = void* (*)( std::size_t );
+
+  explicit heap_resource( source_function source = &_malloc ) noexcept : source_( source ) {}
+
+private:
+  void* do_allocate( std::size_t bytes, std::size_t alignment ) override {
+    return allocate_bytes( bytes, alignment, source_ );
+  }
+
+  void do_deallocate( void* p, std::size_t bytes, std::size_t alignment ) override {
+    deallocate_bytes( p, bytes, alignment );
+  }
+
+  /*  память любого heap_resource освобождается любым другим: _free находит кучу по адресу */
+  bool do_is_equal( std::pmr::memory_resource const& other ) const noexcept override {
+    return dynamic_cast<heap_resource const*>( &other ) != nullptr;
+  }
+
+  source_function source_;
+};
+
+/*  общий экземпляр поверх основной кучи */
+inline heap_resource* main_heap_resource() noexcept {
+  static heap_resource resource;
+  return &resource;
+}
+
+template <class T>
+struct allocator {
+  using value_type = T;
+  using is_always_equal = std::true_type;
+
+  allocator() noexcept = default;
+  template <class U>
+  allocator( allocator<U> const& ) noexcept {}
+
+  T* allocate( std::size_t n ) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof( T )) throw std::bad_array_new_length();
+    return static_cast<T*>( allocate_bytes( n * sizeof( T ), alignof( T ) ) );
+  }
+
+  void deallocate( T* p, std::size_t n ) noexcept { deallocate_bytes( p, n * sizeof( T ), alignof( T ) ); }
+};
+
+template <class T, class U>
+bool operator==( allocator<T> const&, allocator<U> const& ) noexcept { return true; }
+
+template <class T, class U>
+bool operator!=( allocator<T> const&, allocator<U> const& ) noexcept { return false; }
+
+}  // namespace mem
+
+#endif
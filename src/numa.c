@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "mem_internals.h"
+#include "mem.h"
+#include "numa.h"
+#include "util.h"
+
+void debug(const char* fmt, ... );
+
+#define NUMA_ARENA_BASE ((uint8_t*) 0x100000000000)
+#define NUMA_ARENA_SPAN ((size_t) 1 << 36)
+#define NUMA_ARENA_INITIAL (64 * 4096)
+/*  узел потока перепроверяется раз в столько выделений: поток может мигрировать */
+#define NUMA_NODE_REFRESH 1024
+
+static struct heap arenas[NUMA_MAX_NODES];
+static struct heap interleaved;
+static size_t arena_count;
+static size_t online_nodes = 1;
+
+static _Thread_local int forced_node = -1;
+static _Thread_local int cached_node = -1;
+static _Thread_local unsigned cached_node_age;
+
+/*  /sys/devices/system/node/online выглядит как "0" или "0-3" */
+static size_t detect_nodes( void ) {
+  FILE* f = fopen( "/sys/devices/system/node/online", "r" );
+  if (!f) return 1;
+  unsigned first = 0, last = 0;
+  const int read = fscanf( f, "%u-%u", &first, &last );
+  fclose( f );
+  if (read < 2) last = first;
+  const size_t nodes = (size_t) last + 1;
+  return nodes > NUMA_MAX_NODES ? NUMA_MAX_NODES : nodes;
+}
+
+static void bind_region( void* addr, size_t size, int mode, unsigned long nodemask ) {
+  if (syscall( SYS_mbind, addr, size, mode, &nodemask, NUMA_MAX_NODES + 1, 0 ) != 0)
+    debug( "numa: mbind of %p (%zu bytes) failed\n", addr, size );
+}
+
+static void bind_to_arena_node( struct heap* heap, void* addr, size_t size ) {
+  const size_t node = (size_t) (heap - arenas) % online_nodes;
+  bind_region( addr, size, MPOL_BIND, 1UL << node );
+}
+
+static void bind_interleaved( struct heap* heap, void* addr, size_t size ) {
+  (void) heap;
+  const unsigned long all = online_nodes >= 64 ? ~0UL : (1UL << online_nodes) - 1;
+  bind_region( addr, size, MPOL_INTERLEAVE, all );
+}
+
+static void* arena_init( struct heap* heap, size_t index, void (*bind)( struct heap*, void*, size_t ) ) {
+  *heap = (struct heap) {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .span_begin = NUMA_ARENA_BASE + index * NUMA_ARENA_SPAN,
+    .span_end = NUMA_ARENA_BASE + (index + 1) * NUMA_ARENA_SPAN,
+    .on_region = bind
+  };
+  return heap_create( heap, NUMA_ARENA_INITIAL );
+}
+
+/*  число арен, запрошенное первым вызовом numa_arenas_init, плюс один (0 -- вызова ещё не было) */
+static _Atomic size_t arenas_requested;
+static pthread_once_t arenas_once = PTHREAD_ONCE_INIT;
+
+static void arenas_create( void ) {
+  online_nodes = detect_nodes();
+  size_t nodes = atomic_load( &arenas_requested ) - 1;
+  if (nodes == 0) nodes = online_nodes;
+  if (nodes > NUMA_MAX_NODES) nodes = NUMA_MAX_NODES;
+
+  for (arena_count = 0; arena_count < nodes; arena_count++)
+    if (!arena_init( &arenas[arena_count], arena_count, bind_to_arena_node )) break;
+  if (!arena_init( &interleaved, NUMA_MAX_NODES, bind_interleaved ))
+    debug( "numa: failed to create the interleaved heap\n" );
+}
+
+size_t numa_arenas_init( size_t nodes ) {
+  size_t unset = 0;
+  atomic_compare_exchange_strong( &arenas_requested, &unset, nodes + 1 );
+  pthread_once( &arenas_once, arenas_create );
+  return arena_count;
+}
+
+void numa_force_node( int node ) { forced_node = node; }
+
+int numa_current_node( void ) {
+  if (forced_node >= 0) return forced_node;
+  if (cached_node < 0 || ++cached_node_age >= NUMA_NODE_REFRESH) {
+    unsigned cpu = 0, node = 0;
+    if (syscall( SYS_getcpu, &cpu, &node, NULL ) != 0) node = 0;
+    cached_node = (int) node;
+    cached_node_age = 0;
+  }
+  return cached_node;
+}
+
+int numa_arena_of( void const* mem ) {
+  for (size_t i = 0; i < arena_count; i++)
+    if ((uint8_t const*) mem >= (uint8_t const*) arenas[i].span_begin && (uint8_t const*) mem < (uint8_t const*) arenas[i].span_end)
+      return (int) i;
+  return -1;
+}
+
+void* numa_malloc( size_t query ) {
+  if (arena_count == 0) return _malloc( query );
+  return heap_malloc( &arenas[(size_t) numa_current_node() % arena_count], query );
+}
+
+void* numa_malloc_interleaved( size_t query ) {
+  if (!interleaved.start) return _malloc( query );
+  return heap_malloc( &interleaved, query );
+}
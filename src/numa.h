@@ -0,0 +1,27 @@
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+#include <stddef.h>
+
+/*  NUMA-арены: по отдельной куче на каждый узел. Регионы арены привязываются к её узлу через mbind,
+    а numa_malloc выбирает арену узла, на котором сейчас выполняется поток.
+    Для больших общих таблиц есть отдельная куча с чередованием страниц по всем узлам.
+    Память из любой арены освобождается обычным _free. */
+
+#define NUMA_MAX_NODES 64
+
+/*  создать арены; nodes == 0 -- по числу узлов в системе. Если арен больше, чем узлов,
+    арена i привязывается к узлу i % (число узлов) -- так NUMA-логику можно проверить на одном узле.
+    Арены создаются один раз: повторный вызов возвращает их число, не глядя на nodes */
+size_t numa_arenas_init( size_t nodes );
+
+/*  закрепить текущий поток за ареной node (-1 -- снова определять узел автоматически) */
+void   numa_force_node( int node );
+int    numa_current_node( void );
+/*  номер арены, которой принадлежит адрес, или -1 */
+int    numa_arena_of( void const* mem );
+
+void*  numa_malloc( size_t query );
+void*  numa_malloc_interleaved( size_t query );
+
+#endif
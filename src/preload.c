@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mem_internals.h"
+#include "mem.h"
+#include "profile.h"
+#include "tcache.h"
+#include "trace.h"
+
+/*  libmem.so для LD_PRELOAD: семейство malloc поверх _malloc/_free. Библиотека собирается
+    с -fvisibility=hidden, наружу видны только функции с EXPORT, поэтому внутренние имена
+    (err, debug, ...) не перекрывают одноимённые функции libc.
+
+    Начальная загрузка. Куча создаётся при первом вызове, в том числе до конструкторов.
+    Если создание кучи само выделяет память (atexit в сборке с MEM_LEAK_SITES), вложенный вызов
+    того же потока получает память из статического буфера; такие блоки не освобождаются.
+    dlsym не используется, так что рекурсии через него нет.
+
+    fork: в родителе перед fork берутся мьютексы трассы, таблицы профиля, депо tcache и всех куч
+    (в этом порядке), после fork в обоих процессах они отпускаются, поэтому ребёнок не наследует
+    кучу посреди операции. В ребёнке трасса выключается: писатель остался в родителе. */
+
+#define EXPORT __attribute__(( visibility( "default" ) ))
+#define BOOTSTRAP_SIZE (64 * 1024)
+/*  перед блоком из буфера лежит его размер */
+#define BOOTSTRAP_PREFIX BLOCK_ALIGN
+
+static _Alignas( BLOCK_ALIGN ) uint8_t bootstrap[BOOTSTRAP_SIZE];
+static _Atomic size_t bootstrap_used;
+
+static _Atomic bool heap_up;
+static _Thread_local bool heap_starting;
+
+static bool from_bootstrap( void const* mem ) {
+  return (uint8_t const*) mem >= bootstrap && (uint8_t const*) mem < bootstrap + BOOTSTRAP_SIZE;
+}
+
+static size_t bootstrap_size( void const* mem ) { return ((size_t const*) mem)[-1]; }
+
+static void* bootstrap_malloc( size_t alignment, size_t size ) {
+  if (alignment < BLOCK_ALIGN) alignment = BLOCK_ALIGN;
+  size_t used = atomic_load_explicit( &bootstrap_used, memory_order_relaxed );
+  size_t start, end;
+  do {
+    start = (used + BOOTSTRAP_PREFIX + alignment - 1) & ~(alignment - 1);
+    if (start > BOOTSTRAP_SIZE || size > BOOTSTRAP_SIZE - start) return NULL;
+    end = start + size;
+  } while (!atomic_compare_exchange_weak_explicit( &bootstrap_used, &used, end, memory_order_relaxed, memory_order_relaxed ));
+  ((size_t*) (bootstrap + start))[-1] = size;
+  return bootstrap + start;
+}
+
+/*  false -- куча ещё создаётся этим же потоком (или создать её не удалось) */
+static bool heap_start( void ) {
+  if (__builtin_expect( atomic_load_explicit( &heap_up, memory_order_acquire ), 1 )) return true;
+  if (heap_starting) return false;
+  heap_starting = true;
+  mem_config_load();
+  const bool created = heap_init_with( mem_config.initial_size, mem_config.options ) != NULL;
+  heap_starting = false;
+  if (created) atomic_store_explicit( &heap_up, true, memory_order_release );
+  return created;
+}
+
+static void* allocate( size_t alignment, size_t size ) {
+  void* mem;
+  if (!heap_start()) mem = bootstrap_malloc( alignment, size );
+  else if (alignment <= BLOCK_ALIGN) mem = _malloc( size );
+  else mem = _malloc_aligned( alignment, size );
+  if (!mem) errno = ENOMEM;
+  return mem;
+}
+
+static bool power_of_two( size_t x ) { return x && (x & (x - 1)) == 0; }
+
+EXPORT void* malloc( size_t size ) { return allocate( BLOCK_ALIGN, size ); }
+
+EXPORT void free( void* mem ) {
+  if (mem && !from_bootstrap( mem )) _free( mem );
+}
+
+EXPORT void* calloc( size_t count, size_t size ) {
+  size_t bytes;
+  if (__builtin_mul_overflow( count, size, &bytes )) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  void* mem = allocate( BLOCK_ALIGN, bytes );
+  if (mem) memset( mem, 0, bytes );
+  return mem;
+}
+
+EXPORT void* realloc( void* mem, size_t size ) {
+  if (mem && from_bootstrap( mem )) {
+    void* moved = allocate( BLOCK_ALIGN, size );
+    if (moved) memcpy( moved, mem, size < bootstrap_size( mem ) ? size : bootstrap_size( mem ) );
+    return moved;
+  }
+  if (!heap_start()) return allocate( BLOCK_ALIGN, size );
+  void* moved = _realloc( mem, size );
+  if (!moved && size) errno = ENOMEM;
+  return moved;
+}
+
+EXPORT void* memalign( size_t alignment, size_t size ) {
+  if (!power_of_two( alignment )) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return allocate( alignment, size );
+}
+
+EXPORT void* aligned_alloc( size_t alignment, size_t size ) { return memalign( alignment, size ); }
+
+EXPORT int posix_memalign( void** result, size_t alignment, size_t size ) {
+  if (!power_of_two( alignment ) || alignment % sizeof( void* ) != 0) return EINVAL;
+  const int saved = errno;
+  void* mem = allocate( alignment, size );
+  errno = saved;
+  if (!mem) return ENOMEM;
+  *result = mem;
+  return 0;
+}
+
+/*  устаревшие, но экспортируемые glibc: иначе их блоки пришли бы в наш free из чужой кучи */
+EXPORT void* valloc( size_t size ) { return allocate( getpagesize(), size ); }
+
+EXPORT void* pvalloc( size_t size ) {
+  const size_t page = getpagesize();
+  if (size > SIZE_MAX - page) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return allocate( page, (size + page - 1) & ~(page - 1) );
+}
+
+EXPORT size_t malloc_usable_size( void* mem ) {
+  if (!mem) return 0;
+  if (from_bootstrap( mem )) return bootstrap_size( mem );
+  return block_get_header( mem )->capacity.bytes;
+}
+
+static void fork_prepare( void ) {
+  trace_fork_prepare();
+  profile_lock();
+  tcache_lock_all();
+  heap_lock_all();
+}
+
+static void fork_parent( void ) {
+  heap_unlock_all();
+  tcache_unlock_all();
+  profile_unlock();
+  trace_fork_parent();
+}
+
+static void fork_child( void ) {
+  heap_unlock_all();
+  tcache_unlock_all();
+  profile_unlock();
+  trace_fork_child();
+}
+
+__attribute__(( constructor )) static void preload_init( void ) {
+  heap_start();
+  pthread_atfork( fork_prepare, fork_parent, fork_child );
+}
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mem_internals.h"
+#include "mem.h"
+#include "profile.h"
+#include "writer.h"
+
+#define PROFILE_WRITER_BUFFER (64 * 1024)
+
+struct profile_entry {
+  void*  ptr;
+  size_t size;
+  /*  оценка числа байт, которые представляет выборка: size / P(блок попал в выборку) */
+  size_t weight;
+  int    depth;
+  void*  stack[PROFILE_STACK_DEPTH];
+};
+
+_Thread_local int64_t profile_countdown;
+_Atomic bool profile_has_samples;
+
+static _Thread_local uint64_t rng_state;
+/*  backtrace и dladdr могут сами выделять память; вложенные выделения в выборку не попадают */
+static _Thread_local bool in_profile;
+
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct profile_entry* table;
+static size_t table_used;
+static uint64_t dropped;
+
+/*  --- Случайные интервалы ---
+    libm не подключается, поэтому логарифм и экспонента считаются здесь; точности в 1e-6 хватает с запасом */
+
+#define LN2 0.69314718055994530942
+
+static uint64_t rng_next( void ) {
+  if (rng_state == 0) rng_state = (uint64_t) (uintptr_t) &rng_state * 0x9E3779B97F4A7C15ull | 1;
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+/*  ln y для y из [1, 2): ряд по t = (y - 1) / (y + 1), |t| <= 1/3 */
+static double log_mantissa( double y ) {
+  const double t = (y - 1) / (y + 1), t2 = t * t;
+  return 2 * t * (1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 * (1.0 / 9 + t2 / 11)))));
+}
+
+/*  -ln U для U, равномерного на (0, 1]: U = m / 2^53, m = 2^k * y */
+static double exponential( void ) {
+  const uint64_t m = (rng_next() >> 11) + 1;
+  const int k = 63 - __builtin_clzll( m );
+  const double y = (double) m / (double) ((uint64_t) 1 << k);
+  return (53 - k) * LN2 - log_mantissa( y );
+}
+
+/*  e^-x для x >= 0: x = k ln 2 + f, e^-f рядом Тейлора */
+static double exp_negative( double x ) {
+  if (x > 700) return 0;
+  const int k = (int) (x / LN2);
+  const double f = x - k * LN2;
+  double term = 1, sum = 1;
+  for (int i = 1; i < 16; i++) { term *= -f / i; sum += term; }
+  return k < 63 ? sum / (double) ((uint64_t) 1 << k) : 0;
+}
+
+static void next_countdown( size_t rate ) {
+  const double interval = exponential() * (double) rate;
+  profile_countdown = interval < (double) INT64_MAX / 2 ? (int64_t) interval + 1 : INT64_MAX / 2;
+}
+
+/*  --- Таблица выборок ---
+    открытая адресация с линейным пробированием; при удалении следующие записи цепочки сдвигаются
+    назад, поэтому надгробий нет и таблица не деградирует при постоянной смене блоков */
+
+#define TABLE_MASK (PROFILE_TABLE_SIZE - 1)
+
+static size_t home_slot( void const* p ) { return (size_t) (((uintptr_t) p >> 4) * 0x9E3779B97F4A7C15ull) & TABLE_MASK; }
+
+/*  таблица не берётся у кучи, которую описывает */
+static bool table_ready( void ) {
+  if (table) return true;
+  struct profile_entry* t = map_pages( NULL, PROFILE_TABLE_SIZE * sizeof( struct profile_entry ), MAP_NORESERVE );
+  if (t == MAP_FAILED) return false;
+  table = t;
+  return true;
+}
+
+/*  заполненность держится ниже 3/4, иначе пробы удлиняются */
+static bool table_insert( struct profile_entry const* e ) {
+  if (!table_ready() || table_used >= PROFILE_TABLE_SIZE / 4 * 3) return false;
+  size_t i = home_slot( e->ptr );
+  while (table[i].ptr) i = (i + 1) & TABLE_MASK;
+  table[i] = *e;
+  table_used++;
+  return true;
+}
+
+static void table_remove( void const* ptr ) {
+  size_t i = home_slot( ptr );
+  while (table[i].ptr != ptr) {
+    if (!table[i].ptr) return;
+    i = (i + 1) & TABLE_MASK;
+  }
+  /*  запись j можно перенести в дыру i, если её домашняя ячейка не лежит циклически в (i, j] */
+  for (size_t j = (i + 1) & TABLE_MASK; table[j].ptr; j = (j + 1) & TABLE_MASK) {
+    const size_t home = home_slot( table[j].ptr );
+    if (((j - home) & TABLE_MASK) >= ((j - i) & TABLE_MASK)) {
+      table[i] = table[j];
+      i = j;
+    }
+  }
+  table[i].ptr = NULL;
+  table_used--;
+}
+
+void profile_sample( void* mem, size_t query ) {
+  const size_t rate = mem_config.profile_rate;
+  if (rate == 0) { profile_countdown = PROFILE_IDLE_BYTES; return; }
+  next_countdown( rate );
+  if (!mem || in_profile) return;
+
+  in_profile = true;
+  struct profile_entry e = { .ptr = mem, .size = query };
+  const double p = 1 - exp_negative( (double) query / (double) rate );
+  e.weight = p > 0 ? (size_t) ((double) query / p) : query;
+  /*  первый кадр -- сам profile_sample, второй -- _malloc или _realloc */
+  void* stack[PROFILE_STACK_DEPTH + 2];
+  const int depth = backtrace( stack, PROFILE_STACK_DEPTH + 2 );
+  e.depth = depth > 2 ? depth - 2 : 0;
+  memcpy( e.stack, stack + 2, e.depth * sizeof( void* ) );
+
+  pthread_mutex_lock( &table_lock );
+  if (table_insert( &e )) {
+    block_get_header( mem )->is_sampled = true;
+    atomic_store_explicit( &profile_has_samples, true, memory_order_release );
+  } else dropped++;
+  pthread_mutex_unlock( &table_lock );
+  in_profile = false;
+}
+
+void profile_forget( void* mem ) {
+  block_get_header( mem )->is_sampled = false;
+  pthread_mutex_lock( &table_lock );
+  if (table) table_remove( mem );
+  pthread_mutex_unlock( &table_lock );
+}
+
+void profile_lock( void ) { pthread_mutex_lock( &table_lock ); }
+void profile_unlock( void ) { pthread_mutex_unlock( &table_lock ); }
+
+uint64_t profile_dropped( void ) {
+  pthread_mutex_lock( &table_lock );
+  const uint64_t result = dropped;
+  pthread_mutex_unlock( &table_lock );
+  return result;
+}
+
+/*  --- Вывод --- */
+
+/*  "функция+0xсмещение" через dladdr (без выделения памяти), иначе просто адрес */
+static void writer_frame( struct writer* w, void* address ) {
+  Dl_info info;
+  if (dladdr( address, &info ) && info.dli_sname) {
+    writer_string( w, info.dli_sname );
+    writer_put( w, "+", 1 );
+    writer_hex( w, (uintptr_t) address - (uintptr_t) info.dli_saddr );
+  } else {
+    writer_hex( w, (uintptr_t) address );
+  }
+}
+
+static int compare_stacks( const void* a, const void* b ) {
+  struct profile_entry const* x = a;
+  struct profile_entry const* y = b;
+  if (x->depth != y->depth) return x->depth < y->depth ? -1 : 1;
+  return memcmp( x->stack, y->stack, x->depth * sizeof( void* ) );
+}
+
+bool heap_profile_dump( int fd ) {
+  in_profile = true;
+  pthread_mutex_lock( &table_lock );
+  const size_t capacity = table_used ? table_used : 1;
+  struct profile_entry* live = map_pages( NULL, capacity * sizeof( struct profile_entry ), 0 );
+  size_t count = 0;
+  if (live != MAP_FAILED && table)
+    for (size_t i = 0; i < PROFILE_TABLE_SIZE; i++)
+      if (table[i].ptr) live[count++] = table[i];
+  pthread_mutex_unlock( &table_lock );
+  if (live == MAP_FAILED) { in_profile = false; return false; }
+
+  /*  одинаковые стеки оказываются рядом и сливаются в одну строку */
+  qsort( live, count, sizeof( struct profile_entry ), compare_stacks );
+  struct writer w;
+  if (!writer_open( &w, fd, PROFILE_WRITER_BUFFER )) {
+    munmap( live, capacity * sizeof( struct profile_entry ) );
+    in_profile = false;
+    return false;
+  }
+  for (size_t i = 0; i < count;) {
+    size_t bytes = 0, j = i;
+    for (; j < count && compare_stacks( &live[i], &live[j] ) == 0; j++) bytes += live[j].weight;
+    /*  в свёрнутом формате корень стека идёт первым */
+    for (int f = live[i].depth - 1; f >= 0; f--) {
+      writer_frame( &w, live[i].stack[f] );
+      if (f > 0) writer_put( &w, ";", 1 );
+    }
+    if (live[i].depth == 0) writer_string( &w, "[unknown]" );
+    writer_put( &w, " ", 1 );
+    writer_decimal( &w, bytes );
+    writer_put( &w, "\n", 1 );
+    i = j;
+  }
+  const bool written = writer_close( &w );
+  munmap( live, capacity * sizeof( struct profile_entry ) );
+  in_profile = false;
+  return written;
+}
@@ -0,0 +1,42 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Выборочный профиль кучи по байтам, как в tcmalloc. У каждого потока есть счётчик байт до
+    следующей выборки; каждый _malloc вычитает из него размер запроса. Когда счётчик уходит в минус,
+    блок попадает в выборку: снимается стек вызовов, блок помечается в заголовке (is_sampled)
+    и запоминается в отдельной таблице, а следующий интервал берётся из экспоненциального
+    распределения со средним profile_rate, так что выборки образуют пуассоновский поток по байтам.
+    _free и кэш потока (tcache_free) убирают помеченный блок из таблицы.
+
+    Профиль включается параметром profile_rate (MEM_CONF или _mallopt); при выключенном профиле
+    поток раз в PROFILE_IDLE_BYTES байт проверяет, не включили ли его. */
+
+#define PROFILE_STACK_DEPTH 32
+#define PROFILE_TABLE_SIZE (1 << 15)
+#define PROFILE_IDLE_BYTES ((int64_t) 16 << 20)
+
+extern _Thread_local int64_t profile_countdown;
+/*  выставляется первой выборкой; до неё освобождение без чтения заголовка (tcache_free_sized)
+    может не проверять is_sampled */
+extern _Atomic bool profile_has_samples;
+
+void profile_sample( void* mem, size_t query );
+void profile_forget( void* mem );
+/*  мьютекс таблицы выборок, например вокруг fork */
+void profile_lock( void );
+void profile_unlock( void );
+/*  сколько выборок пропущено из-за переполненной таблицы */
+uint64_t profile_dropped( void );
+
+/*  единственная операция на горячем пути -- вычитание из счётчика потока */
+#define PROFILE_MALLOC( mem, query ) \
+  do { \
+    if (__builtin_expect( (profile_countdown -= (int64_t) (query)) < 0, 0 )) profile_sample( (mem), (query) ); \
+  } while (0)
+
+#endif
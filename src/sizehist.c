@@ -0,0 +1,49 @@
+#include <stdatomic.h>
+
+#include "sizehist.h"
+
+static struct {
+  _Atomic uint64_t allocs;
+  _Atomic uint64_t bytes;
+} requests[SIZE_BUCKETS];
+
+static _Atomic int64_t live[SIZE_BUCKETS];
+
+size_t size_bucket_index( size_t size ) {
+  if (size < 2 * SIZE_SUB_BUCKETS) return size;
+  const size_t log = 63 - __builtin_clzll( size );
+  const size_t sub = (size >> (log - SIZE_SUB_BITS)) & (SIZE_SUB_BUCKETS - 1);
+  return (log - SIZE_SUB_BITS + 1) * SIZE_SUB_BUCKETS + sub;
+}
+
+size_t size_bucket_lower( size_t index ) {
+  if (index < 2 * SIZE_SUB_BUCKETS) return index;
+  const size_t log = index / SIZE_SUB_BUCKETS + SIZE_SUB_BITS - 1;
+  return (size_t) (SIZE_SUB_BUCKETS + index % SIZE_SUB_BUCKETS) << (log - SIZE_SUB_BITS);
+}
+
+void size_histogram_record_malloc( size_t query, size_t capacity ) {
+  const size_t i = size_bucket_index( query );
+  atomic_fetch_add_explicit( &requests[i].allocs, 1, memory_order_relaxed );
+  atomic_fetch_add_explicit( &requests[i].bytes, query, memory_order_relaxed );
+  atomic_fetch_add_explicit( &live[size_bucket_index( capacity )], 1, memory_order_relaxed );
+}
+
+void size_histogram_record_free( size_t capacity ) {
+  atomic_fetch_sub_explicit( &live[size_bucket_index( capacity )], 1, memory_order_relaxed );
+}
+
+void size_histogram_record_resize( size_t old_capacity, size_t new_capacity ) {
+  size_histogram_record_free( old_capacity );
+  atomic_fetch_add_explicit( &live[size_bucket_index( new_capacity )], 1, memory_order_relaxed );
+}
+
+void size_histogram_get( struct size_bucket requests_out[SIZE_BUCKETS], int64_t live_out[SIZE_BUCKETS] ) {
+  for (size_t i = 0; i < SIZE_BUCKETS; i++) {
+    requests_out[i] = (struct size_bucket) {
+      .allocs = atomic_load_explicit( &requests[i].allocs, memory_order_relaxed ),
+      .bytes = atomic_load_explicit( &requests[i].bytes, memory_order_relaxed )
+    };
+    live_out[i] = atomic_load_explicit( &live[i], memory_order_relaxed );
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef _SIZEHIST_H_
+#define _SIZEHIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Гистограмма размеров запросов: логарифмические корзины по степеням двойки,
+    каждая поделена на SIZE_SUB_BUCKETS линейных частей. Размеры до 8 байт считаются точно.
+    Гистограмм две с одинаковыми корзинами: запросы (allocs, bytes) -- по запрошенному размеру,
+    живые блоки -- по вместимости выданного блока, потому что при освобождении известна только она. */
+
+#define SIZE_SUB_BITS 2
+#define SIZE_SUB_BUCKETS (1 << SIZE_SUB_BITS)
+#define SIZE_BUCKETS ((64 - SIZE_SUB_BITS + 1) * SIZE_SUB_BUCKETS)
+
+struct size_bucket {
+  uint64_t allocs;
+  uint64_t bytes;
+};
+
+size_t size_bucket_index( size_t size );
+/*  наименьший размер, попадающий в корзину */
+size_t size_bucket_lower( size_t index );
+
+void size_histogram_record_malloc( size_t query, size_t capacity );
+void size_histogram_record_free( size_t capacity );
+/*  блок изменил вместимость на месте: живой объект переезжает в другую корзину */
+void size_histogram_record_resize( size_t old_capacity, size_t new_capacity );
+
+/*  копия текущих счётчиков: запросы по размеру и живые блоки по вместимости */
+void size_histogram_get( struct size_bucket requests[SIZE_BUCKETS], int64_t live[SIZE_BUCKETS] );
+
+#endif
@@ -0,0 +1,98 @@
+#define _DEFAULT_SOURCE
+#include <unistd.h>
+#include <stdbool.h>
+
+#include "mem.h"
+#include "slab.h"
+#include "util.h"
+
+struct slab {
+  struct slab*       next;
+  size_t             object_size;
+  size_t             capacity;
+  _Atomic uint64_t   bitmap[SLAB_BITMAP_WORDS];
+  uint8_t            objects[];
+};
+
+#define SLAB_OBJECT_ALIGN 16
+
+static size_t align_up( size_t x, size_t a ) { return (x + a - 1) / a * a; }
+
+static size_t slab_objects_offset( void ) { return align_up( offsetof( struct slab, objects ), SLAB_OBJECT_ALIGN ); }
+
+static uint8_t* slab_object( struct slab* s, size_t i ) { return (uint8_t*) s + slab_objects_offset() + i * s->object_size; }
+
+/*  слаб занимает ровно одну страницу, поэтому его заголовок находится по адресу объекта, округлённому вниз до страницы */
+static struct slab* slab_of( void* object ) {
+  return (struct slab*) ((uintptr_t) object & ~((uintptr_t) getpagesize() - 1));
+}
+
+static struct slab* slab_create( size_t object_size ) {
+  const size_t page = getpagesize();
+  struct slab* s = map_pages( NULL, page, 0 );
+  if (s == MAP_FAILED) return NULL;
+
+  size_t capacity = (page - slab_objects_offset()) / object_size;
+  if (capacity > SLAB_BITMAP_WORDS * 64) capacity = SLAB_BITMAP_WORDS * 64;
+
+  s->next = NULL;
+  s->object_size = object_size;
+  s->capacity = capacity;
+  /*  биты за пределами вместимости навсегда помечены занятыми */
+  for (size_t w = 0; w < SLAB_BITMAP_WORDS; w++) {
+    uint64_t taken = 0;
+    for (size_t b = 0; b < 64; b++)
+      if (w * 64 + b >= capacity) taken |= (uint64_t) 1 << b;
+    atomic_init( &s->bitmap[w], taken );
+  }
+  return s;
+}
+
+static void* slab_try_alloc( struct slab* s ) {
+  for (size_t w = 0; w < SLAB_BITMAP_WORDS; w++) {
+    uint64_t word = atomic_load_explicit( &s->bitmap[w], memory_order_relaxed );
+    while (~word != 0) {
+      const unsigned bit = __builtin_ctzll( ~word );
+      const uint64_t mask = (uint64_t) 1 << bit;
+      const uint64_t old = atomic_fetch_or_explicit( &s->bitmap[w], mask, memory_order_acquire );
+      if (!(old & mask)) return slab_object( s, w * 64 + bit );
+      word = old | mask;
+    }
+  }
+  return NULL;
+}
+
+void slab_cache_init( struct slab_cache* cache, size_t object_size ) {
+  object_size = align_up( size_max( object_size, SLAB_MIN_OBJECT ), SLAB_OBJECT_ALIGN );
+  if (object_size > SLAB_MAX_OBJECT)
+    err( "slab: object size %zu is larger than %d\n", object_size, SLAB_MAX_OBJECT );
+  cache->object_size = object_size;
+  atomic_init( &cache->slabs, NULL );
+}
+
+void* slab_alloc( struct slab_cache* cache ) {
+  for (;;) {
+    struct slab* head = atomic_load_explicit( &cache->slabs, memory_order_acquire );
+    for (struct slab* s = head; s; s = s->next) {
+      void* object = slab_try_alloc( s );
+      if (object) return object;
+    }
+
+    /*  все слабы заполнены: добавляем новый в голову списка; если другой поток успел раньше, пробуем ещё раз */
+    struct slab* fresh = slab_create( cache->object_size );
+    if (!fresh) return NULL;
+    void* object = slab_try_alloc( fresh );
+    fresh->next = head;
+    if (atomic_compare_exchange_strong_explicit( &cache->slabs, &head, fresh,
+                                                 memory_order_release, memory_order_relaxed ))
+      return object;
+    munmap( fresh, getpagesize() );
+  }
+}
+
+void slab_free( void* object ) {
+  if (!object) return;
+  struct slab* s = slab_of( object );
+  const size_t i = ((uint8_t*) object - slab_object( s, 0 )) / s->object_size;
+  atomic_fetch_and_explicit( &s->bitmap[i / 64], ~((uint64_t) 1 << (i % 64)), memory_order_release );
+}
@@ -0,0 +1,27 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*  Слаб -- одна страница, полученная через map_pages и разбитая на объекты одного размера.
+    Занятость объектов хранится в битовой карте, которая меняется только атомарными
+    fetch_or / fetch_and, поэтому выделять и освобождать объекты можно из любых потоков без блокировок. */
+
+#define SLAB_BITMAP_WORDS 8
+#define SLAB_MIN_OBJECT 16
+#define SLAB_MAX_OBJECT 1024
+
+struct slab;
+
+struct slab_cache {
+  size_t                  object_size;
+  _Atomic(struct slab*)   slabs;
+};
+
+void  slab_cache_init( struct slab_cache* cache, size_t object_size );
+void* slab_alloc( struct slab_cache* cache );
+void  slab_free( void* object );
+
+#endif
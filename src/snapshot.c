@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "mem_internals.h"
+#include "mem.h"
+#include "snapshot.h"
+#include "util.h"
+
+/*  Снимок собирается в отдельное отображение: размер берётся по счётчикам блоков заранее, а под
+    мьютексом кучи записи только копируются, так что каждая куча задерживается на один проход
+    по списку. Если куча успела вырасти, буфер расширяется через mremap, не трогая кучу.
+    Готовый буфер уходит в файл одним write (повтор -- только при частичной записи). */
+
+struct snapshot_state {
+  uint8_t* buffer;
+  size_t   length, capacity;
+  size_t   record_size;
+  uint32_t heaps;
+  bool     failed;
+};
+
+static size_t round_pages( size_t bytes ) {
+  const size_t page = getpagesize();
+  return (bytes + page - 1) / page * page;
+}
+
+static bool snapshot_reserve( struct snapshot_state* s, size_t bytes ) {
+  if (s->length + bytes <= s->capacity) return true;
+  const size_t capacity = round_pages( size_max( 2 * s->capacity, s->length + bytes ) );
+  uint8_t* grown = mremap( s->buffer, s->capacity, capacity, MREMAP_MAYMOVE );
+  if (grown == MAP_FAILED) return false;
+  s->buffer = grown;
+  s->capacity = capacity;
+  return true;
+}
+
+static void snapshot_heap( struct heap* heap, void* arg ) {
+  struct snapshot_state* s = arg;
+  s->heaps++;
+  if (s->failed) return;
+  if (!snapshot_reserve( s, (heap->stats.free_blocks + heap->stats.used_blocks) * s->record_size )) {
+    s->failed = true;
+    return;
+  }
+  for (struct block_header const* b = heap->start; b; b = b->next) {
+    if (!snapshot_reserve( s, s->record_size )) { s->failed = true; return; }
+    const struct snapshot_record r = {
+      .address = (uintptr_t) b,
+      .capacity = b->capacity.bytes | (b->is_free ? SNAPSHOT_FREE_BIT : 0),
+#ifdef MEM_LEAK_SITES
+      .site = (uintptr_t) b->site,
+#endif
+    };
+    memcpy( s->buffer + s->length, &r, s->record_size );
+    s->length += s->record_size;
+  }
+}
+
+bool heap_snapshot( int fd ) {
+  struct snapshot_file_header header = {
+    .magic = SNAPSHOT_MAGIC,
+    .version = SNAPSHOT_VERSION,
+#ifdef MEM_LEAK_SITES
+    .record_size = sizeof( struct snapshot_record ),
+    .flags = SNAPSHOT_HAS_SITES,
+#else
+    .record_size = SNAPSHOT_RECORD_SHORT,
+#endif
+  };
+  const struct heap_stats stats = heap_stats();
+  /*  запас на блоки, появившиеся между heap_stats и обходом */
+  const size_t estimate = sizeof( header ) + (stats.free_blocks + stats.used_blocks) * header.record_size * 5 / 4;
+  struct snapshot_state s = { .record_size = header.record_size, .capacity = round_pages( estimate ) };
+  s.buffer = map_pages( NULL, s.capacity, 0 );
+  if (s.buffer == MAP_FAILED) return false;
+  s.length = sizeof( header );
+
+  heap_for_each( snapshot_heap, &s );
+
+  struct timespec now;
+  clock_gettime( CLOCK_REALTIME, &now );
+  header.timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  header.count = (s.length - sizeof( header )) / header.record_size;
+  header.heaps = s.heaps;
+  memcpy( s.buffer, &header, sizeof( header ) );
+
+  bool ok = !s.failed;
+  for (size_t done = 0; ok && done < s.length;) {
+    const ssize_t n = write( fd, s.buffer + done, s.length - done );
+    if (n <= 0) ok = false;
+    else done += n;
+  }
+  munmap( s.buffer, s.capacity );
+  return ok;
+}
+
+bool snapshot_file_open( const char* path, struct snapshot_file* s ) {
+  const int fd = open( path, O_RDONLY );
+  if (fd < 0) return false;
+  struct stat st;
+  const bool sized = fstat( fd, &st ) == 0 && (size_t) st.st_size >= sizeof( struct snapshot_file_header );
+  s->base = sized ? mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) : MAP_FAILED;
+  close( fd );
+  if (s->base == MAP_FAILED) return false;
+  s->length = st.st_size;
+
+  s->header = (struct snapshot_file_header const*) s->base;
+  const size_t record_size = s->header->record_size;
+  const bool has_sites = s->header->flags & SNAPSHOT_HAS_SITES;
+  if (memcmp( s->header->magic, SNAPSHOT_MAGIC, sizeof( s->header->magic ) ) != 0
+      || s->header->version != SNAPSHOT_VERSION
+      || record_size != (has_sites ? sizeof( struct snapshot_record ) : SNAPSHOT_RECORD_SHORT)
+      || s->header->count > (s->length - sizeof( *s->header )) / record_size) {
+    munmap( s->base, s->length );
+    return false;
+  }
+  s->records = s->base + sizeof( *s->header );
+  s->count = s->header->count;
+  return true;
+}
+
+void snapshot_file_close( struct snapshot_file* s ) { munmap( s->base, s->length ); }
+
+struct snapshot_record snapshot_file_record( struct snapshot_file const* s, size_t i ) {
+  struct snapshot_record r = {0};
+  memcpy( &r, s->records + i * s->header->record_size, s->header->record_size );
+  return r;
+}
@@ -0,0 +1,54 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Бинарный снимок списков блоков (heap_snapshot). Файл: snapshot_file_header, за ним count записей
+    по record_size байт: адрес заголовка и вместимость со старшим битом "свободен", а в сборке
+    с MEM_LEAK_SITES (флаг SNAPSHOT_HAS_SITES) ещё и место выделения. Блоки с отдельным
+    отображением в списки куч не входят и в снимок не попадают. */
+
+#define SNAPSHOT_MAGIC "MEMSNAPS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HAS_SITES 1
+#define SNAPSHOT_FREE_BIT ((uint64_t) 1 << 63)
+
+struct snapshot_file_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t count;
+  /*  CLOCK_REALTIME в наносекундах */
+  uint64_t timestamp;
+  uint32_t flags;
+  uint32_t heaps;
+};
+
+struct snapshot_record {
+  uint64_t address;
+  uint64_t capacity;
+  uint64_t site;
+};
+
+/*  длина записи без места выделения */
+#define SNAPSHOT_RECORD_SHORT offsetof( struct snapshot_record, site )
+
+/*  записанный снимок, отображённый в память только для чтения */
+struct snapshot_file {
+  uint8_t*                           base;
+  size_t                             length;
+  struct snapshot_file_header const* header;
+  uint8_t const*                     records;
+  size_t                             count;
+};
+
+/*  false, если файла нет или это не снимок текущего формата */
+bool snapshot_file_open( const char* path, struct snapshot_file* s );
+void snapshot_file_close( struct snapshot_file* s );
+
+/*  i-я запись; site равен 0, если снимок сделан без мест выделения */
+struct snapshot_record snapshot_file_record( struct snapshot_file const* s, size_t i );
+
+#endif
@@ -0,0 +1,165 @@
+#define _DEFAULT_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sizehist.h"
+#include "snapshot.h"
+
+/*  Сравнение двух снимков кучи (snapshot.h): на сколько выросли занятые блоки по размерным
+    корзинам гистограммы размеров и по местам выделения (если снимки сделаны в сборке
+    с MEM_LEAK_SITES). Строки с ростом идут первыми, по убыванию прироста байт; строки
+    без изменений не печатаются. Места выделения -- адреса в процессе, сделавшем снимки,
+    их можно перевести в строки исходника через addr2line. */
+
+struct usage {
+  uint64_t blocks, bytes;
+};
+
+struct growth {
+  uint64_t     key;
+  struct usage before, after;
+};
+
+struct totals {
+  struct usage used, free;
+};
+
+static int64_t growth_delta( struct growth const* g ) { return (int64_t) (g->after.bytes - g->before.bytes); }
+
+static int compare_growth( const void* a, const void* b ) {
+  const int64_t x = growth_delta( a ), y = growth_delta( b );
+  return x > y ? -1 : x < y;
+}
+
+static int compare_u64( const void* a, const void* b ) {
+  const uint64_t x = *(uint64_t const*) a, y = *(uint64_t const*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void totals_add( struct totals* t, struct snapshot_file const* s ) {
+  for (size_t i = 0; i < s->count; i++) {
+    const struct snapshot_record r = snapshot_file_record( s, i );
+    struct usage* u = (r.capacity & SNAPSHOT_FREE_BIT) ? &t->free : &t->used;
+    u->blocks++;
+    u->bytes += r.capacity & ~SNAPSHOT_FREE_BIT;
+  }
+}
+
+static void print_header( const char* title, const char* key ) {
+  printf( " --- %s ---\n%18s %14s %14s %14s %14s %14s\n", title, key,
+          "blocks_before", "blocks_after", "bytes_before", "bytes_after", "delta_bytes" );
+}
+
+static void print_growth( struct growth const* g, const char* key_format ) {
+  char key[32];
+  snprintf( key, sizeof( key ), key_format, g->key );
+  printf( "%18s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %+14" PRId64 "\n", key,
+          g->before.blocks, g->after.blocks, g->before.bytes, g->after.bytes, growth_delta( g ) );
+}
+
+static void print_changed( struct growth* rows, size_t count, const char* key_format ) {
+  qsort( rows, count, sizeof( struct growth ), compare_growth );
+  for (size_t i = 0; i < count; i++)
+    if (rows[i].before.blocks != rows[i].after.blocks || rows[i].before.bytes != rows[i].after.bytes)
+      print_growth( &rows[i], key_format );
+}
+
+static void by_size_class( struct snapshot_file const* before, struct snapshot_file const* after ) {
+  static struct growth rows[SIZE_BUCKETS];
+  for (size_t i = 0; i < SIZE_BUCKETS; i++) rows[i] = (struct growth) { .key = size_bucket_lower( i ) };
+  for (int side = 0; side < 2; side++) {
+    struct snapshot_file const* s = side ? after : before;
+    for (size_t i = 0; i < s->count; i++) {
+      const struct snapshot_record r = snapshot_file_record( s, i );
+      if (r.capacity & SNAPSHOT_FREE_BIT) continue;
+      struct usage* u = side ? &rows[size_bucket_index( r.capacity )].after : &rows[size_bucket_index( r.capacity )].before;
+      u->blocks++;
+      u->bytes += r.capacity;
+    }
+  }
+  print_header( "Used blocks by size class", "size_from" );
+  print_changed( rows, SIZE_BUCKETS, "%" PRIu64 );
+}
+
+/*  занятые блоки снимка парами (место, вместимость), отсортированными по месту */
+static uint64_t* sites_sorted( struct snapshot_file const* s, size_t* count ) {
+  uint64_t* pairs = malloc( 2 * sizeof( uint64_t ) * (s->count ? s->count : 1) );
+  if (!pairs) return NULL;
+  *count = 0;
+  for (size_t i = 0; i < s->count; i++) {
+    const struct snapshot_record r = snapshot_file_record( s, i );
+    if (r.capacity & SNAPSHOT_FREE_BIT) continue;
+    pairs[2 * *count] = r.site;
+    pairs[2 * *count + 1] = r.capacity;
+    (*count)++;
+  }
+  qsort( pairs, *count, 2 * sizeof( uint64_t ), compare_u64 );
+  return pairs;
+}
+
+static bool by_site( struct snapshot_file const* before, struct snapshot_file const* after ) {
+  size_t nb, na;
+  uint64_t* b = sites_sorted( before, &nb );
+  uint64_t* a = sites_sorted( after, &na );
+  struct growth* rows = malloc( sizeof( struct growth ) * (nb + na + 1) );
+  if (!a || !b || !rows) {
+    free( a ); free( b ); free( rows );
+    return false;
+  }
+  /*  слияние двух отсортированных списков, по строке на место */
+  size_t count = 0;
+  for (size_t i = 0, j = 0; i < nb || j < na;) {
+    const uint64_t site = j == na || (i < nb && b[2 * i] < a[2 * j]) ? b[2 * i] : a[2 * j];
+    struct growth* g = &rows[count++];
+    *g = (struct growth) { .key = site };
+    for (; i < nb && b[2 * i] == site; i++) { g->before.blocks++; g->before.bytes += b[2 * i + 1]; }
+    for (; j < na && a[2 * j] == site; j++) { g->after.blocks++; g->after.bytes += a[2 * j + 1]; }
+  }
+  print_header( "Used blocks by allocation site", "site" );
+  print_changed( rows, count, "0x%" PRIx64 );
+  free( a ); free( b ); free( rows );
+  return true;
+}
+
+/*  snapshot_diff <до> <после> */
+int main( int argc, char** argv ) {
+  if (argc != 3) {
+    fprintf( stderr, "usage: %s <before> <after>\n", argv[0] );
+    return 2;
+  }
+  struct snapshot_file before, after;
+  if (!snapshot_file_open( argv[1], &before )) {
+    fprintf( stderr, "%s: not a readable heap snapshot\n", argv[1] );
+    return 1;
+  }
+  if (!snapshot_file_open( argv[2], &after )) {
+    fprintf( stderr, "%s: not a readable heap snapshot\n", argv[2] );
+    snapshot_file_close( &before );
+    return 1;
+  }
+
+  struct totals tb = {0}, ta = {0};
+  totals_add( &tb, &before );
+  totals_add( &ta, &after );
+  printf( " --- %.3f s between snapshots ---\n",
+          (double) (int64_t) (after.header->timestamp - before.header->timestamp) / 1e9 );
+  printf( "used: %" PRIu64 " -> %" PRIu64 " blocks, %" PRIu64 " -> %" PRIu64 " bytes (%+" PRId64 ")\n",
+          tb.used.blocks, ta.used.blocks, tb.used.bytes, ta.used.bytes, (int64_t) (ta.used.bytes - tb.used.bytes) );
+  printf( "free: %" PRIu64 " -> %" PRIu64 " blocks, %" PRIu64 " -> %" PRIu64 " bytes (%+" PRId64 ")\n",
+          tb.free.blocks, ta.free.blocks, tb.free.bytes, ta.free.bytes, (int64_t) (ta.free.bytes - tb.free.bytes) );
+
+  by_size_class( &before, &after );
+  bool ok = true;
+  if ((before.header->flags & after.header->flags) & SNAPSHOT_HAS_SITES) ok = by_site( &before, &after );
+  else printf( " --- No allocation sites: take both snapshots in a MEM_LEAK_SITES build ---\n" );
+
+  snapshot_file_close( &before );
+  snapshot_file_close( &after );
+  if (!ok) {
+    fprintf( stderr, "out of memory\n" );
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,306 @@
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "mem_internals.h"
+#include "mem.h"
+#include "profile.h"
+#include "tcache.h"
+
+struct magazine {
+  struct magazine* next;
+  size_t           rounds;
+  size_t           capacity;
+  void*            objects[];
+};
+
+/*  в депо лежат непустые магазины (full) и пустые (empty); *_min -- минимум длины списка
+    с прошлой обрезки, то есть магазины, которые за интервал так никому и не понадобились */
+struct depot {
+  pthread_mutex_t  lock;
+  struct magazine* full;
+  struct magazine* empty;
+  size_t           full_count, full_min;
+  size_t           empty_count, empty_min;
+  size_t           ops;
+};
+
+struct tcache {
+  struct magazine* loaded[TCACHE_CLASSES];
+  struct magazine* previous[TCACHE_CLASSES];
+};
+
+static size_t class_size[TCACHE_CLASSES];
+static size_t class_count;
+static size_t class_max;
+
+static struct depot depots[TCACHE_CLASSES];
+static _Thread_local struct tcache cache;
+static _Thread_local bool cache_registered;
+
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+
+/*  деструкторы других ключей могут снова положить блоки в магазины: флаг сбрасывается,
+    следующий вызов заново ставит значение ключа, и деструктор сработает ещё раз */
+static void tcache_thread_exit( void* unused ) {
+  (void) unused;
+  tcache_flush();
+  cache_registered = false;
+}
+
+static void tcache_init( void ) {
+  mem_config_load();
+  class_count = mem_config.size_class_count;
+  for (size_t c = 0; c < class_count; c++) class_size[c] = mem_config.size_classes[c];
+  class_max = class_size[class_count - 1];
+  for (size_t c = 0; c < TCACHE_CLASSES; c++)
+    depots[c] = (struct depot) { .lock = PTHREAD_MUTEX_INITIALIZER };
+  pthread_key_create( &tcache_key, tcache_thread_exit );
+}
+
+/*  деструктор ключа вызывается только для потоков, у которых значение не NULL */
+static void tcache_register( void ) {
+  pthread_once( &tcache_once, tcache_init );
+  pthread_setspecific( tcache_key, &cache );
+  cache_registered = true;
+}
+
+/*  наименьший класс, вмещающий query */
+static size_t class_for_query( size_t query ) {
+  size_t c = 0;
+  while (class_size[c] < query) c++;
+  return c;
+}
+
+/*  наибольший класс, который целиком помещается в блок вместимости capacity */
+static size_t class_for_capacity( size_t capacity ) {
+  size_t c = class_count - 1;
+  while (class_size[c] > capacity) c--;
+  return c;
+}
+
+/*  --- Депо --- */
+
+static struct magazine* list_pop( struct magazine** list ) {
+  struct magazine* m = *list;
+  if (m) *list = m->next;
+  return m;
+}
+
+static void list_push( struct magazine** list, struct magazine* m ) {
+  m->next = *list;
+  *list = m;
+}
+
+static void depot_trim_locked( struct depot* d, struct magazine** full, struct magazine** empty ) {
+  for (; d->full_min > 0; d->full_min--, d->full_count--) list_push( full, list_pop( &d->full ) );
+  for (; d->empty_min > 0; d->empty_min--, d->empty_count--) list_push( empty, list_pop( &d->empty ) );
+  d->full_min = d->full_count;
+  d->empty_min = d->empty_count;
+  d->ops = 0;
+}
+
+static void release_magazines( struct magazine* full, struct magazine* empty ) {
+  while (full) {
+    struct magazine* m = list_pop( &full );
+    while (m->rounds > 0) _free( m->objects[--m->rounds] );
+    _free( m );
+  }
+  while (empty) _free( list_pop( &empty ) );
+}
+
+/*  каждая операция с депо считается; раз в DEPOT_TRIM_INTERVAL операций депо ужимается */
+static void depot_tick( struct depot* d, struct magazine** full, struct magazine** empty ) {
+  if (++d->ops >= DEPOT_TRIM_INTERVAL) depot_trim_locked( d, full, empty );
+}
+
+static void depot_put( size_t c, struct magazine* m, bool full ) {
+  struct depot* d = &depots[c];
+  struct magazine *trim_full = NULL, *trim_empty = NULL;
+
+  pthread_mutex_lock( &d->lock );
+  if (full) { list_push( &d->full, m ); d->full_count++; }
+  else      { list_push( &d->empty, m ); d->empty_count++; }
+  depot_tick( d, &trim_full, &trim_empty );
+  pthread_mutex_unlock( &d->lock );
+
+  release_magazines( trim_full, trim_empty );
+}
+
+static struct magazine* depot_get( size_t c, bool full ) {
+  struct depot* d = &depots[c];
+  struct magazine *trim_full = NULL, *trim_empty = NULL;
+
+  pthread_mutex_lock( &d->lock );
+  struct magazine* got;
+  if (full) {
+    got = list_pop( &d->full );
+    if (got && --d->full_count < d->full_min) d->full_min = d->full_count;
+  } else {
+    got = list_pop( &d->empty );
+    if (got && --d->empty_count < d->empty_min) d->empty_min = d->empty_count;
+  }
+  depot_tick( d, &trim_full, &trim_empty );
+  pthread_mutex_unlock( &d->lock );
+
+  release_magazines( trim_full, trim_empty );
+  return got;
+}
+
+/*  размер магазина берётся из cache_size в момент создания, поэтому магазины разного размера могут сосуществовать */
+static struct magazine* magazine_new( void ) {
+  const size_t capacity = mem_config.cache_size;
+  struct magazine* m = _malloc( sizeof( struct magazine ) + capacity * sizeof( void* ) );
+  if (m) *m = (struct magazine) { .capacity = capacity };
+  return m;
+}
+
+/*  --- Кэш потока --- */
+
+static void swap_magazines( size_t c ) {
+  struct magazine* t = cache.loaded[c];
+  cache.loaded[c] = cache.previous[c];
+  cache.previous[c] = t;
+}
+
+void* tcache_malloc( size_t query ) {
+  if (!cache_registered) tcache_register();
+  if (query > class_max) return _malloc( query );
+  const size_t c = class_for_query( query );
+
+  struct magazine* m = cache.loaded[c];
+  if (m && m->rounds > 0) return m->objects[--m->rounds];
+
+  if (cache.previous[c] && cache.previous[c]->rounds > 0) {
+    swap_magazines( c );
+    m = cache.loaded[c];
+    return m->objects[--m->rounds];
+  }
+
+  struct magazine* full = depot_get( c, true );
+  if (full) {
+    if (cache.previous[c]) depot_put( c, cache.previous[c], false );
+    cache.previous[c] = cache.loaded[c];
+    cache.loaded[c] = full;
+    return full->objects[--full->rounds];
+  }
+
+  return _malloc( class_size[c] );
+}
+
+static void cache_push( size_t c, void* mem ) {
+  struct magazine* m = cache.loaded[c];
+  if (m && m->rounds < m->capacity) { m->objects[m->rounds++] = mem; return; }
+
+  if (cache.previous[c] && cache.previous[c]->rounds == 0) {
+    swap_magazines( c );
+    m = cache.loaded[c];
+    m->objects[m->rounds++] = mem;
+    return;
+  }
+
+  /*  оба магазина полны: previous уходит в депо, взамен берём пустой */
+  struct magazine* empty = depot_get( c, false );
+  if (!empty) empty = magazine_new();
+  if (!empty) { _free( mem ); return; }
+  if (cache.previous[c]) depot_put( c, cache.previous[c], true );
+  cache.previous[c] = cache.loaded[c];
+  cache.loaded[c] = empty;
+  empty->objects[empty->rounds++] = mem;
+}
+
+/*  блок, выданный _malloc при промахе кэша, мог попасть в выборку профиля: в магазине он уже свободен */
+void tcache_free( void* mem ) {
+  if (!mem) return;
+  struct block_header* header = block_get_header( mem );
+  if (header->is_sampled) profile_forget( mem );
+  const size_t capacity = header->capacity.bytes;
+  if (!cache_registered) tcache_register();
+  if (capacity < class_size[0] || capacity > class_max) { _free( mem ); return; }
+  cache_push( class_for_capacity( capacity ), mem );
+}
+
+/*  tcache_malloc( size ) выдаёт блок класса class_for_query( size ), так что по тому же размеру
+    класс находится без заголовка блока */
+void tcache_free_sized( void* mem, size_t size ) {
+  if (!mem) return;
+  /*  заголовок читается, только если профиль хоть раз делал выборку */
+  if (__builtin_expect( atomic_load_explicit( &profile_has_samples, memory_order_acquire ), 0 )
+      && block_get_header( mem )->is_sampled)
+    profile_forget( mem );
+  if (!cache_registered) tcache_register();
+  if (size > class_max) { _free( mem ); return; }
+  cache_push( class_for_query( size ), mem );
+}
+
+void tcache_flush( void ) {
+  for (size_t c = 0; c < TCACHE_CLASSES; c++) {
+    struct magazine* mags[2] = { cache.loaded[c], cache.previous[c] };
+    for (size_t i = 0; i < 2; i++)
+      if (mags[i]) depot_put( c, mags[i], mags[i]->rounds > 0 );
+    cache.loaded[c] = cache.previous[c] = NULL;
+  }
+}
+
+void tcache_depot_trim( void ) {
+  pthread_once( &tcache_once, tcache_init );
+  for (size_t c = 0; c < TCACHE_CLASSES; c++) {
+    struct magazine *trim_full = NULL, *trim_empty = NULL;
+    pthread_mutex_lock( &depots[c].lock );
+    depot_trim_locked( &depots[c], &trim_full, &trim_empty );
+    pthread_mutex_unlock( &depots[c].lock );
+    release_magazines( trim_full, trim_empty );
+  }
+}
+
+void tcache_depot_release( void ) {
+  pthread_once( &tcache_once, tcache_init );
+  for (size_t c = 0; c < TCACHE_CLASSES; c++) {
+    struct depot* d = &depots[c];
+    pthread_mutex_lock( &d->lock );
+    struct magazine *full = d->full, *empty = d->empty;
+    d->full = d->empty = NULL;
+    d->full_count = d->full_min = d->empty_count = d->empty_min = 0;
+    pthread_mutex_unlock( &d->lock );
+    release_magazines( full, empty );
+  }
+}
+
+static void visit_magazine( struct magazine const* m, void (*fn)( void* mem, void* arg ), void* arg ) {
+  for (size_t i = 0; i < m->rounds; i++) fn( m->objects[i], arg );
+  fn( (void*) m, arg );
+}
+
+void tcache_for_each_cached( void (*fn)( void* mem, void* arg ), void* arg ) {
+  pthread_once( &tcache_once, tcache_init );
+  for (size_t c = 0; c < TCACHE_CLASSES; c++) {
+    if (cache.loaded[c]) visit_magazine( cache.loaded[c], fn, arg );
+    if (cache.previous[c]) visit_magazine( cache.previous[c], fn, arg );
+    pthread_mutex_lock( &depots[c].lock );
+    for (struct magazine const* m = depots[c].full; m; m = m->next) visit_magazine( m, fn, arg );
+    for (struct magazine const* m = depots[c].empty; m; m = m->next) visit_magazine( m, fn, arg );
+    pthread_mutex_unlock( &depots[c].lock );
+  }
+}
+
+/*  депо всех классов под мьютексами разом (вокруг fork); порядок всегда один и тот же */
+void tcache_lock_all( void ) {
+  pthread_once( &tcache_once, tcache_init );
+  for (size_t c = 0; c < TCACHE_CLASSES; c++) pthread_mutex_lock( &depots[c].lock );
+}
+
+void tcache_unlock_all( void ) {
+  for (size_t c = TCACHE_CLASSES; c > 0; c--) pthread_mutex_unlock( &depots[c - 1].lock );
+}
+
+size_t tcache_depot_magazines( void ) {
+  pthread_once( &tcache_once, tcache_init );
+  size_t count = 0;
+  for (size_t c = 0; c < TCACHE_CLASSES; c++) {
+    pthread_mutex_lock( &depots[c].lock );
+    count += depots[c].full_count;
+    pthread_mutex_unlock( &depots[c].lock );
+  }
+  return count;
+}
@@ -0,0 +1,49 @@
+#ifndef _TCACHE_H_
+#define _TCACHE_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*  Кэш потока поверх _malloc/_free в духе магазинов Бонвика.
+    У каждого потока на каждый размерный класс есть два магазина (loaded и previous);
+    когда их не хватает, целые магазины обмениваются с общим депо за O(1).
+    Депо периодически ужимается до рабочего набора, лишнее возвращается в кучу. */
+
+/*  размерные классы по умолчанию -- степени двойки от 16 до TCACHE_MAX_SIZE;
+    их можно заменить ключом size_classes в MEM_CONF (читается при первом обращении к кэшу) */
+#define TCACHE_CLASSES 8
+#define TCACHE_MAX_SIZE 2048
+/*  размер магазина по умолчанию, меняется параметром cache_size */
+#define MAGAZINE_SIZE 32
+#define DEPOT_TRIM_INTERVAL 1024
+
+void* tcache_malloc( size_t query );
+void  tcache_free( void* mem );
+/*  освободить блок, полученный от tcache_malloc( size ), не читая его заголовок
+    (пока профиль не сделал ни одной выборки, см. profile.h) */
+void  tcache_free_sized( void* mem, size_t size );
+
+/*  вернуть магазины текущего потока в депо (вызывается автоматически при завершении потока) */
+void  tcache_flush( void );
+/*  отдать в кучу магазины депо, не использованные с прошлой обрезки */
+void  tcache_depot_trim( void );
+/*  отдать в кучу все магазины депо вместе с блоками в них */
+void  tcache_depot_release( void );
+/*  fn( mem, arg ) для каждого блока в магазинах текущего потока и в депо, а также для самих
+    магазинов; ничего не освобождает. Депо обходится под его мьютексами, поэтому fn не должна
+    обращаться к кэшу. Магазины других потоков не видны. */
+void  tcache_for_each_cached( void (*fn)( void* mem, void* arg ), void* arg );
+/*  мьютексы депо всех классов (вокруг fork) */
+void  tcache_lock_all( void );
+void  tcache_unlock_all( void );
+/*  количество непустых магазинов в депо по всем классам */
+size_t tcache_depot_magazines( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
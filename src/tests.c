@@ -1,11 +1,47 @@
 
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "tests.h"
+#include "config.h"
 #include "mem.h"
 #include "mem_internals.h"
+#include "latency.h"
+#include "numa.h"
+#include "profile.h"
+#include "sizehist.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "tcache.h"
+#include "trace.h"
+#include "trace_analysis.h"
 #include "util.h"
 
 static void * memory_heap;
 
+// Ленивая инициализация: первый _malloc сам создаёт кучу, а heap_init после него возвращает её же.
+// Запускается до heap_init, поэтому стоит отдельно от остальных тестов.
+static bool test_lazy_init() {
+    printf("Test lazy init: _malloc before heap_init...\n");
+    void * malloc_1 = _malloc(100);
+    if (malloc_1 == NULL || block_get_header(malloc_1) != HEAP_START) {
+        printf("Test lazy init failed: first _malloc didn't create the heap at HEAP_START. \n");
+        return false;
+    }
+    _free(malloc_1);
+    if (heap_init(500) != HEAP_START) {
+        printf("Test lazy init failed: heap_init didn't return the existing heap. \n");
+        return false;
+    }
+    printf("Test lazy init passed! \n");
+    return true;
+}
+
 // Обычное успешное выделение памяти.
 static bool test_1() {
     printf("Test 1: Usual successful memory allocation...\n");
@@ -175,28 +211,1036 @@ static bool test_5() {
     return false;    
 }
 
+#define STRESS_THREADS 4
+#define STRESS_ROUNDS 20000
+#define STRESS_BATCH 32
+#define STRESS_OBJECT 48
+
+static struct slab_cache stress_cache;
+
+struct stress_job {
+    size_t id;
+    size_t errors;
+};
+
+/*  каждый поток заполняет свои объекты своей меткой и проверяет, что никто другой их не получил */
+static void* stress_worker( void* arg ) {
+    struct stress_job* job = arg;
+    void* objects[STRESS_BATCH];
+    for (size_t round = 0; round < STRESS_ROUNDS; round++) {
+        for (size_t i = 0; i < STRESS_BATCH; i++) {
+            objects[i] = slab_alloc( &stress_cache );
+            if (objects[i] == NULL) { job->errors++; continue; }
+            *(size_t*) objects[i] = job->id * STRESS_BATCH + i;
+        }
+        for (size_t i = 0; i < STRESS_BATCH; i++) {
+            if (objects[i] == NULL) continue;
+            if (*(size_t*) objects[i] != job->id * STRESS_BATCH + i) job->errors++;
+            slab_free( objects[i] );
+        }
+    }
+    return NULL;
+}
+
+// Слабы: много потоков одновременно выделяют и освобождают объекты без блокировок.
+// Пропускная способность слабов меряется в bench_threads (-a slab).
+static bool test_slab_stress() {
+    printf("Test slab stress: %d threads allocate and free from the same slabs...\n", STRESS_THREADS);
+    slab_cache_init( &stress_cache, STRESS_OBJECT );
+    pthread_t threads[STRESS_THREADS];
+    struct stress_job jobs[STRESS_THREADS];
+    for (size_t i = 0; i < STRESS_THREADS; i++) {
+        jobs[i] = (struct stress_job) {.id = i};
+        pthread_create( &threads[i], NULL, stress_worker, &jobs[i] );
+    }
+    size_t errors = 0;
+    for (size_t i = 0; i < STRESS_THREADS; i++) {
+        pthread_join( threads[i], NULL );
+        errors += jobs[i].errors;
+    }
+    if (errors != 0) {
+        printf("Test slab stress failed: %zu objects were lost or shared between threads. \n", errors);
+        return false;
+    }
+    printf("Test slab stress passed! \n");
+    return true;
+}
+
+#define DEPOT_OBJECTS 256
+#define DEPOT_OBJECT_SIZE 64
+
+static void* depot_freed[DEPOT_OBJECTS];
+
+static void* depot_producer( void* unused ) {
+    (void) unused;
+    for (size_t i = 0; i < DEPOT_OBJECTS; i++) depot_freed[i] = tcache_malloc( DEPOT_OBJECT_SIZE );
+    for (size_t i = 0; i < DEPOT_OBJECTS; i++) tcache_free( depot_freed[i] );
+    return NULL;
+}
+
+/*  деструктор ключа, созданного после ключа tcache: срабатывает уже после сброса магазинов потока */
+static void late_exit( void* unused ) {
+    (void) unused;
+    tcache_free( tcache_malloc( DEPOT_OBJECT_SIZE ) );
+}
+
+static void* late_user( void* key ) {
+    tcache_free( tcache_malloc( DEPOT_OBJECT_SIZE ) );
+    pthread_setspecific( *(pthread_key_t*) key, key );
+    return NULL;
+}
+
+static bool was_freed_by_producer( void* p ) {
+    for (size_t i = 0; i < DEPOT_OBJECTS; i++)
+        if (depot_freed[i] == p) return true;
+    return false;
+}
+
+// Магазины: память, освобождённая одним потоком, через депо достаётся другому вместо роста кучи.
+static bool test_depot_rebalance() {
+    printf("Test depot: magazines freed on one thread are reused by another...\n");
+    pthread_t producer;
+    pthread_create( &producer, NULL, depot_producer, NULL );
+    pthread_join( producer, NULL );
+
+    if (tcache_depot_magazines() == 0) {
+        printf("Test depot failed: exiting thread left nothing in the depot. \n");
+        return false;
+    }
+
+    void* reused[DEPOT_OBJECTS / 2];
+    bool ok = true;
+    for (size_t i = 0; i < DEPOT_OBJECTS / 2; i++) {
+        reused[i] = tcache_malloc( DEPOT_OBJECT_SIZE );
+        if (!was_freed_by_producer( reused[i] )) ok = false;
+    }
+    for (size_t i = 0; i < DEPOT_OBJECTS / 2; i++) tcache_free( reused[i] );
+    if (!ok) {
+        printf("Test depot failed: allocation bypassed the depot. \n");
+        return false;
+    }
+
+    /*  две обрезки подряд: после первой весь депо -- вне рабочего набора */
+    tcache_flush();
+    tcache_depot_trim();
+    tcache_depot_trim();
+    if (tcache_depot_magazines() != 0) {
+        printf("Test depot failed: idle magazines survived trimming. \n");
+        return false;
+    }
+
+    pthread_key_t late_key;
+    pthread_key_create( &late_key, late_exit );
+    pthread_t late;
+    pthread_create( &late, NULL, late_user, &late_key );
+    pthread_join( late, NULL );
+    pthread_key_delete( late_key );
+    const size_t late_magazines = tcache_depot_magazines();
+    tcache_depot_release();
+    if (late_magazines == 0) {
+        printf("Test depot failed: block freed in a late TSD destructor stayed in a dead thread. \n");
+        return false;
+    }
+    printf("Test depot passed! \n");
+    return true;
+}
+
+#define SIZED_QUERIES 5
+
+// Освобождение с размером: блок возвращается в магазин своего класса без чтения заголовка.
+static bool test_tcache_free_sized() {
+    printf("Test tcache_free_sized: blocks return to the class of their size...\n");
+    const size_t sizes[SIZED_QUERIES] = { 1, 24, 100, TCACHE_MAX_SIZE, 4 * TCACHE_MAX_SIZE };
+    void* blocks[SIZED_QUERIES];
+    for (size_t i = 0; i < SIZED_QUERIES; i++) blocks[i] = tcache_malloc( sizes[i] );
+    for (size_t i = 0; i < SIZED_QUERIES; i++) tcache_free_sized( blocks[i], sizes[i] );
+
+    /*  магазин -- стек, так что тот же размер сразу получает тот же блок */
+    bool ok = true;
+    for (size_t i = 0; i + 1 < SIZED_QUERIES; i++) {
+        void* again = tcache_malloc( sizes[i] );
+        if (again != blocks[i]) ok = false;
+        tcache_free_sized( again, sizes[i] );
+    }
+    if (!ok) {
+        printf("Test tcache_free_sized failed: a block went to the wrong class. \n");
+        return false;
+    }
+    printf("Test tcache_free_sized passed! \n");
+    return true;
+}
+
+// _free_sized: блок возвращается в кучу тем же путём, что и через _free; последний размер --
+// выше порога mmap_threshold, выставленного на время теста, и проходит через отдельное отображение.
+static bool test_free_sized() {
+    printf("Test _free_sized: sized free returns blocks to the heap...\n");
+    const size_t sizes[] = { 1, 100, 4 * TCACHE_MAX_SIZE };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); i++) {
+        void* mem = _malloc( sizes[i] );
+        const struct heap_stats before = heap_stats();
+        _free_sized( mem, sizes[i] );
+        const struct heap_stats after = heap_stats();
+        if (after.frees != before.frees + 1 || after.used_blocks != before.used_blocks - 1) ok = false;
+        /*  первый подходящий блок -- только что освобождённый */
+        void* again = _malloc( sizes[i] );
+        if (again != mem) ok = false;
+        _free_sized( again, sizes[i] );
+    }
+
+    const size_t threshold = mem_config.mmap_threshold;
+    _mallopt( MEM_OPT_MMAP_THRESHOLD, 64 * 1024 );
+    void* mapped = _malloc( 128 * 1024 );
+    const struct heap_stats before_mapped = heap_stats();
+    if (mapped == NULL || !block_get_header( mapped )->is_mapped) ok = false;
+    else _free_sized( mapped, 128 * 1024 );
+    if (heap_stats().mmapped_blocks != before_mapped.mmapped_blocks - 1) ok = false;
+    _mallopt( MEM_OPT_MMAP_THRESHOLD, threshold );
+    _free_sized( NULL, 8 );
+    if (!ok) {
+        printf("Test _free_sized failed: block did not return to the heap. \n");
+        return false;
+    }
+    printf("Test _free_sized passed! \n");
+    return true;
+}
+
+#define BATCH_BLOCKS 64
+#define BATCH_QUERY 40
+#define BATCH_HEADER offsetof( struct block_header, contents )
+#define BATCH_STRIDE (((BATCH_QUERY + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1)) + BATCH_HEADER)
+
+// Пакеты: блоки вырезаются подряд из одного места, а после освобождения пакета сливаются обратно в один.
+static bool test_batch() {
+    printf("Test batch: _malloc_batch carves one run, _free_batch coalesces it...\n");
+    /*  лишний элемент -- NULL, который _free_batch должен пропустить */
+    void* blocks[BATCH_BLOCKS + 1] = {0};
+    const struct heap_stats before = heap_stats();
+    if (_malloc_batch( BATCH_QUERY, BATCH_BLOCKS, blocks ) != BATCH_BLOCKS) {
+        printf("Test batch failed: batch allocation came up short. \n");
+        return false;
+    }
+    const struct heap_stats taken = heap_stats();
+    bool ok = taken.used_blocks == before.used_blocks + BATCH_BLOCKS && taken.mallocs == before.mallocs + BATCH_BLOCKS;
+    for (size_t i = 0; i < BATCH_BLOCKS; i++) {
+        memset( blocks[i], (int) i, BATCH_QUERY );
+        if (i > 0 && (uint8_t*) blocks[i] != (uint8_t*) blocks[i - 1] + BATCH_STRIDE) ok = false;
+    }
+    for (size_t i = 0; i < BATCH_BLOCKS; i++)
+        if (((uint8_t*) blocks[i])[0] != (uint8_t) i || ((uint8_t*) blocks[i])[BATCH_QUERY - 1] != (uint8_t) i) ok = false;
+    if (!ok) {
+        printf("Test batch failed: blocks are not one contiguous run. \n");
+        return false;
+    }
+
+    void* const first = blocks[0];
+    for (size_t i = BATCH_BLOCKS; i > 0; i--) {
+        const size_t j = (size_t) rand() % (i + 1);
+        void* t = blocks[i]; blocks[i] = blocks[j]; blocks[j] = t;
+    }
+    _free_batch( blocks, BATCH_BLOCKS + 1 );
+    const struct heap_stats freed = heap_stats();
+    struct block_header const* merged = block_get_header( first );
+    if (freed.used_blocks != before.used_blocks || freed.frees != taken.frees + BATCH_BLOCKS
+        || !merged->is_free || merged->capacity.bytes < BATCH_BLOCKS * BATCH_STRIDE - BATCH_HEADER) {
+        printf("Test batch failed: the run was not freed and merged back. \n");
+        return false;
+    }
+    printf("Test batch passed! \n");
+    return true;
+}
+
+static int memory_policy( void* addr ) {
+    int mode = -1;
+    if (syscall( SYS_get_mempolicy, &mode, NULL, 0, addr, MPOL_F_ADDR ) != 0) return -1;
+    return mode;
+}
+
+// NUMA: поток, закреплённый за узлом, получает память из арены этого узла, привязанной через mbind.
+static bool test_numa_arenas() {
+    printf("Test NUMA: two forced arenas on whatever nodes this machine has...\n");
+    if (numa_arenas_init( 2 ) != 2) {
+        printf("Test NUMA failed: arenas were not created. \n");
+        return false;
+    }
+
+    bool ok = true;
+    for (int node = 0; node < 2; node++) {
+        numa_force_node( node );
+        void* p = numa_malloc( 20000 );
+        if (p == NULL || numa_arena_of( p ) != node || memory_policy( p ) != MPOL_BIND) {
+            printf("Test NUMA failed: allocation for node %d went to arena %d with policy %d. \n",
+                   node, numa_arena_of( p ), memory_policy( p ));
+            ok = false;
+        }
+        _free( p );
+    }
+    numa_force_node( -1 );
+    if (numa_arenas_init( 2 ) != 2) {
+        printf("Test NUMA failed: a second numa_arenas_init lost the arenas. \n");
+        ok = false;
+    }
+
+    void* table = numa_malloc_interleaved( 100000 );
+    if (table == NULL || numa_arena_of( table ) != -1 || memory_policy( table ) != MPOL_INTERLEAVE) {
+        printf("Test NUMA failed: interleaved table has policy %d. \n", memory_policy( table ));
+        ok = false;
+    }
+    _free( table );
+
+    if (ok) printf("Test NUMA passed! \n");
+    return ok;
+}
+
+#define RESERVE_BYTES (1024 * 1024)
+
+static bool pages_resident( void* addr, size_t length ) {
+    const size_t page = getpagesize();
+    uint8_t* begin = (uint8_t*) ((uintptr_t) addr & ~(page - 1));
+    const size_t pages = ((uint8_t*) addr + length - begin + page - 1) / page;
+    unsigned char residency[pages];
+    if (mincore( begin, pages * page, residency ) != 0) return false;
+    for (size_t i = 0; i < pages; i++)
+        if (!(residency[i] & 1)) return false;
+    return true;
+}
+
+// Предзагрузка: heap_reserve заранее выращивает кучу, и память следующего _malloc уже в RAM.
+static bool test_heap_reserve() {
+    printf("Test reserve: heap_reserve grows and prefaults ahead of a burst...\n");
+    if (!heap_reserve( RESERVE_BYTES )) {
+        printf("Test reserve failed: heap_reserve returned false. \n");
+        return false;
+    }
+    void* burst = _malloc( RESERVE_BYTES );
+    if (burst == NULL || !pages_resident( burst, RESERVE_BYTES )) {
+        printf("Test reserve failed: reserved pages were not resident. \n");
+        _free( burst );
+        return false;
+    }
+    _free( burst );
+    printf("Test reserve passed! \n");
+    return true;
+}
+
+static bool any_page_resident( void* addr, size_t length ) {
+    const size_t page = getpagesize();
+    uint8_t* begin = (uint8_t*) (((uintptr_t) addr + page - 1) & ~(page - 1));
+    const size_t pages = ((uint8_t*) addr + length - begin) / page;
+    unsigned char residency[pages];
+    if (mincore( begin, pages * page, residency ) != 0) return true;
+    for (size_t i = 0; i < pages; i++)
+        if (residency[i] & 1) return true;
+    return false;
+}
+
+// Настройки: MEM_CONF-строка и _mallopt меняют порог mmap и возврат хвоста кучи без пересборки.
+static bool test_runtime_config() {
+    printf("Test config: MEM_CONF parsing and _mallopt...\n");
+    const struct mem_config saved = mem_config;
+    bool ok = true;
+
+    if (!mem_config_parse( "mmap_threshold=256k,trim_threshold=64k,split_threshold=32" )
+        || mem_config.mmap_threshold != 256 * 1024 || mem_config.split_threshold != 32) {
+        printf("Test config failed: valid configuration was not applied. \n");
+        ok = false;
+    }
+    if (mem_config_parse( "no_such_key=1" ) || mem_config_parse( "region_min=12q" )
+        || _mallopt( MEM_OPT_SPLIT_THRESHOLD, 1 ) || _mallopt( -1, 0 )) {
+        printf("Test config failed: invalid configuration was accepted. \n");
+        ok = false;
+    }
+    const size_t threshold = mem_config.mmap_threshold;
+    if (mem_config_parse( "mmap_threshold=-1" ) || mem_config_parse( "mmap_threshold= -4k" )
+        || mem_config_parse( "mmap_threshold=99999999999999999999" )
+        || mem_config_parse( "mmap_threshold=17179869184g" ) || mem_config.mmap_threshold != threshold) {
+        printf("Test config failed: negative or overflowing size was accepted. \n");
+        ok = false;
+    }
+    if (!mem_config_parse( "size_classes=24:48:1k" ) || mem_config.size_class_count != 3
+        || mem_config.size_classes[2] != 1024
+        || mem_config_parse( "size_classes=64:32" ) || mem_config_parse( "size_classes=1:2:3:4:5:6:7:8:9" )) {
+        printf("Test config failed: size_classes list was parsed incorrectly. \n");
+        ok = false;
+    }
+
+    void* large = _malloc( 300 * 1024 );
+    if (large == NULL || !block_get_header( large )->is_mapped) {
+        printf("Test config failed: request above mmap_threshold was served from the heap. \n");
+        ok = false;
+    }
+    _free( large );
+
+    const size_t tail_size = 200 * 1024;
+    uint8_t* tail = _malloc( tail_size );
+    if (tail == NULL) {
+        printf("Test config failed: tail block didn't allocate. \n");
+        ok = false;
+    } else {
+        for (size_t i = 0; i < tail_size; i++) tail[i] = 1;
+        _free( tail );
+        if (any_page_resident( tail, tail_size )) {
+            printf("Test config failed: free tail above trim_threshold stayed resident. \n");
+            ok = false;
+        }
+    }
+
+    if (_mallopt( MEM_OPT_HEAP_START, 0x10000000 ) || _mallopt( MEM_OPT_HEAP_SIZE, 1 << 20 )) {
+        printf("Test config failed: heap layout changed after the heap was created. \n");
+        ok = false;
+    }
+    mem_config = saved;
+
+    /*  регион не кратного странице размера сдвинул бы адрес следующего, и куча больше не выросла бы */
+    if (!_mallopt( MEM_OPT_REGION_MIN, 10000 ) || mem_config.region_min_size % getpagesize() != 0) {
+        printf("Test config failed: region_min was not rounded to a page. \n");
+        ok = false;
+    }
+    const size_t grows = heap_stats().grows;
+    void* chain = NULL;
+    for (size_t i = 0; i < 100000 && heap_stats().grows < grows + 4; i++) {
+        void** block = _malloc( 1000 );
+        if (block == NULL) {
+            printf("Test config failed: heap stopped growing with region_min=10000. \n");
+            ok = false;
+            break;
+        }
+        *block = chain;
+        chain = block;
+    }
+    while (chain) {
+        void* next = *(void**) chain;
+        _free( chain );
+        chain = next;
+    }
+    mem_config = saved;
+
+    if (ok) printf("Test config passed! \n");
+    return ok;
+}
+
+static bool stats_consistent( struct heap_stats const* s ) {
+    return s->mapped_bytes == s->in_use_bytes + s->free_bytes + s->header_bytes + s->mmapped_bytes
+        && s->header_bytes == (s->used_blocks + s->free_blocks) * offsetof(struct block_header, contents);
+}
+
+// Статистика: счётчики сходятся с содержимым кучи и меняются ровно на число операций.
+static bool test_heap_stats() {
+    printf("Test stats: heap_stats follows malloc and free...\n");
+    const struct heap_stats before = heap_stats();
+    void* blocks[10];
+    for (size_t i = 0; i < 10; i++) blocks[i] = _malloc(100 + i);
+    const struct heap_stats during = heap_stats();
+    for (size_t i = 0; i < 10; i++) _free(blocks[i]);
+    const struct heap_stats after = heap_stats();
+
+    size_t largest_in_main_heap = 0;
+    for (struct block_header const* b = memory_heap; b; b = b->next)
+        if (b->is_free && b->capacity.bytes > largest_in_main_heap) largest_in_main_heap = b->capacity.bytes;
+
+    if (!stats_consistent(&before) || !stats_consistent(&during) || !stats_consistent(&after)) {
+        printf("Test stats failed: byte counters don't add up to mapped bytes. \n");
+        return false;
+    }
+    if (during.mallocs - before.mallocs != 10 || after.frees - during.frees != 10
+        || during.used_blocks - before.used_blocks != 10 || after.used_blocks != before.used_blocks) {
+        printf("Test stats failed: operation or block counters are off. \n");
+        return false;
+    }
+    if (after.largest_free < largest_in_main_heap || after.regions == 0) {
+        printf("Test stats failed: largest free block or region count is wrong. \n");
+        return false;
+    }
+    printf("Test stats passed! \n");
+    return true;
+}
+
+// Гистограмма размеров: известная нагрузка попадает в нужные корзины с точными счётчиками.
+static bool test_size_histogram() {
+    printf("Test size histogram: counters match a known workload...\n");
+    static struct size_bucket before[SIZE_BUCKETS], during[SIZE_BUCKETS], after[SIZE_BUCKETS];
+    static int64_t live_before[SIZE_BUCKETS], live_during[SIZE_BUCKETS], live_after[SIZE_BUCKETS];
+    const size_t small = size_bucket_index(40), large = size_bucket_index(1000);
+    void* blocks[150];
+
+    size_histogram_get(before, live_before);
+    for (size_t i = 0; i < 150; i++) blocks[i] = _malloc(i < 100 ? 40 : 1000);
+    size_histogram_get(during, live_during);
+    static int64_t expected_live[SIZE_BUCKETS];
+    for (size_t i = 0; i < 150; i++) expected_live[size_bucket_index(block_get_header(blocks[i])->capacity.bytes)]++;
+    for (size_t i = 0; i < 150; i++) _free(blocks[i]);
+    size_histogram_get(after, live_after);
+
+    if (during[small].allocs - before[small].allocs != 100 || during[small].bytes - before[small].bytes != 4000
+        || during[large].allocs - before[large].allocs != 50 || during[large].bytes - before[large].bytes != 50000) {
+        printf("Test size histogram failed: allocation counters are off. \n");
+        return false;
+    }
+    for (size_t i = 0; i < SIZE_BUCKETS; i++) {
+        if (live_during[i] - live_before[i] != expected_live[i] || live_after[i] != live_before[i]) {
+            printf("Test size histogram failed: live object counters are off. \n");
+            return false;
+        }
+    }
+    if (size_bucket_lower(small) > 40 || size_bucket_lower(small + 1) <= 40) {
+        printf("Test size histogram failed: bucket bounds don't contain the size. \n");
+        return false;
+    }
+    printf("Test size histogram passed! \n");
+    return true;
+}
+
+// Задержки: гистограмма даёт правильные перцентили, а в сборке с MEM_LATENCY замеряются _malloc и _free.
+static bool test_latency_histograms() {
+    printf("Test latency: HDR histogram percentiles and allocator recording...\n");
+    static struct latency_histogram h;
+    for (uint64_t v = 1; v <= 1000; v++) latency_histogram_record(&h, v);
+    const uint64_t median = latency_histogram_percentile(&h, 50), p99 = latency_histogram_percentile(&h, 99);
+    if (median < 500 * 7 / 8 || median > 500 || p99 < 990 * 7 / 8 || p99 > 990 || h.max != 1000) {
+        printf("Test latency failed: percentiles are %" PRIu64 " and %" PRIu64 ". \n", median, p99);
+        return false;
+    }
+
+#ifdef MEM_LATENCY
+    latency_reset();
+    latency_set_threshold(1);
+    _free(_malloc(100));
+    struct latency_sample samples[2];
+    if (latency_path_histogram(LATENCY_FREE)->total != 1
+        || latency_path_histogram(LATENCY_FAST)->total + latency_path_histogram(LATENCY_SEARCH)->total != 1
+        || latency_slow_samples(samples, 2) != 2 || samples[0].depth <= 0) {
+        printf("Test latency failed: allocator operations were not recorded. \n");
+        return false;
+    }
+    /*  рост записывается после освобождения мьютекса кучи, вместе со стеком */
+    latency_reset();
+    _free(_malloc(heap_stats().largest_free + (1 << 20)));
+    if (latency_path_histogram(LATENCY_GROW)->total != 1 || latency_slow_samples(samples, 1) != 1
+        || samples[0].path != LATENCY_FREE) {
+        printf("Test latency failed: heap growth was not recorded. \n");
+        return false;
+    }
+    latency_set_threshold(0);
+#endif
+    printf("Test latency passed! \n");
+    return true;
+}
+
+// _realloc: рост на месте за счёт свободного соседа и перенос с сохранением содержимого.
+static bool test_realloc() {
+    printf("Test realloc: growing in place and moving...\n");
+    uint8_t* a = _malloc(100);
+    uint8_t* b = _malloc(100);
+    uint8_t* c = _malloc(100);
+    for (size_t i = 0; i < 100; i++) a[i] = (uint8_t) i;
+    _free(b);
+
+    uint8_t* grown = _realloc(a, 150);
+    uint8_t* moved = _realloc(grown, 1000);
+    bool ok = grown == a && moved != a && moved != NULL;
+    for (size_t i = 0; ok && i < 100; i++) ok = moved[i] == (uint8_t) i;
+    _free(moved);
+    _free(c);
+    const struct heap_stats stats = heap_stats();
+    ok = ok && stats_consistent(&stats);
+    if (!ok) {
+        printf("Test realloc failed: block wasn't grown in place, contents were lost or stats drifted. \n");
+        return false;
+    }
+    printf("Test realloc passed! \n");
+    return true;
+}
+
+// Трасса: события _malloc/_realloc/_free попадают в файл записями фиксированного размера.
+static pthread_key_t trace_exit_key;
+
+static void trace_exit_free(void* mem) { _free(mem); }
+
+// блок освобождается деструктором TSD уже после деструктора буфера трассы
+static void* trace_exit_worker(void* mem) {
+    *(void**) mem = _malloc(77);
+    pthread_setspecific(trace_exit_key, *(void**) mem);
+    return NULL;
+}
+
+static bool test_trace() {
+    printf("Test trace: binary allocation trace...\n");
+    char path[] = "/tmp/mem-trace-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0 || !trace_start(path)) {
+        printf("Test trace failed: trace didn't start. \n");
+        return false;
+    }
+    void* a = _malloc(123);
+    void* b = _realloc(a, 4567);
+    _free(b);
+    void* exiting = NULL;
+    pthread_t worker;
+    pthread_key_create(&trace_exit_key, trace_exit_free);
+    pthread_create(&worker, NULL, trace_exit_worker, &exiting);
+    pthread_join(worker, NULL);
+    pthread_key_delete(trace_exit_key);
+    trace_stop();
+
+    struct trace_file_header header;
+    struct trace_record records[64];
+    const bool header_read = read(fd, &header, sizeof(header)) == sizeof(header);
+    const ssize_t bytes = read(fd, records, sizeof(records));
+    close(fd);
+    unlink(path);
+
+    if (!header_read || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0
+        || header.record_size != sizeof(struct trace_record) || bytes < 3 * (ssize_t) sizeof(struct trace_record)) {
+        printf("Test trace failed: file header or records are missing. \n");
+        return false;
+    }
+    size_t matched = 0;
+    for (size_t i = 0; i < bytes / sizeof(struct trace_record); i++) {
+        const struct trace_record* r = &records[i];
+        // блок потока может занять адрес b: каждая запись засчитывается один раз
+        if (r->op == TRACE_MALLOC && r->ptr == (uintptr_t) a && r->size == 123) matched++;
+        else if (r->op == TRACE_REALLOC && r->ptr == (uintptr_t) b && r->old_ptr == (uintptr_t) a && r->size == 4567) matched++;
+        else if (r->op == TRACE_FREE && (r->ptr == (uintptr_t) b || r->ptr == (uintptr_t) exiting)) matched++;
+    }
+    if (matched != 4 || trace_dropped() != 0) {
+        printf("Test trace failed: expected events were not recorded. \n");
+        return false;
+    }
+    printf("Test trace passed! \n");
+    return true;
+}
+
+// синтетическая трасса во временном файле path (шаблон mkstemp); записи идут в порядке массива
+static bool write_trace(char* path, struct trace_record const* records, size_t count) {
+    const int fd = mkstemp(path);
+    if (fd < 0) return false;
+    struct trace_file_header header = { .version = TRACE_VERSION, .record_size = sizeof(struct trace_record) };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    const bool written = write(fd, &header, sizeof(header)) == sizeof(header)
+                         && write(fd, records, count * sizeof(*records)) == (ssize_t) (count * sizeof(*records));
+    close(fd);
+    return written;
+}
+
+// записи после trace_file_sort идут с данными timestamp и tid
+static bool trace_sorted_as(struct trace_record const* written, size_t count,
+                            uint64_t const* expected_time, uint32_t const* expected_tid) {
+    char path[] = "/tmp/mem-trace-XXXXXX";
+    struct trace_file t;
+    const bool opened = write_trace(path, written, count) && trace_file_open(path, &t);
+    unlink(path);
+    if (!opened) return false;
+    bool ordered = trace_file_sort(&t) && t.count == count;
+    for (size_t i = 0; ordered && i < count; i++)
+        ordered = t.records[i].timestamp == expected_time[i] && t.records[i].tid == expected_tid[i];
+    trace_file_close(&t);
+    return ordered;
+}
+
+// Трасса потоков: куски сброса идут в файле подряд, после слияния записи упорядочены
+// по timestamp, а записи одного потока сохраняют свой порядок. Два куска сливаются за один
+// проход, три -- за два.
+static bool test_trace_sort() {
+    printf("Test trace sort: merging per-thread chunks by timestamp...\n");
+    const struct trace_record two_runs[] = {
+        { .timestamp = 30, .ptr = 0x1000, .tid = 2, .op = TRACE_MALLOC, .size = 64 },
+        { .timestamp = 50, .ptr = 0x1000, .tid = 2, .op = TRACE_FREE },
+        { .timestamp = 10, .ptr = 0x2000, .tid = 1, .op = TRACE_MALLOC, .size = 32 },
+        { .timestamp = 20, .ptr = 0x2000, .tid = 1, .op = TRACE_FREE },
+        { .timestamp = 50, .ptr = 0x1000, .tid = 1, .op = TRACE_MALLOC, .size = 16 },
+        { .timestamp = 60, .ptr = 0x1000, .tid = 2, .op = TRACE_MALLOC, .size = 8 },
+    };
+    const uint64_t two_runs_time[] = { 10, 20, 30, 50, 50, 60 };
+    const uint32_t two_runs_tid[] = { 1, 1, 2, 2, 1, 2 };
+    const struct trace_record three_runs[] = {
+        { .timestamp = 5, .tid = 3, .op = TRACE_MALLOC }, { .timestamp = 6, .tid = 3, .op = TRACE_MALLOC },
+        { .timestamp = 3, .tid = 2, .op = TRACE_MALLOC }, { .timestamp = 4, .tid = 2, .op = TRACE_MALLOC },
+        { .timestamp = 1, .tid = 1, .op = TRACE_MALLOC }, { .timestamp = 2, .tid = 1, .op = TRACE_MALLOC },
+    };
+    const uint64_t three_runs_time[] = { 1, 2, 3, 4, 5, 6 };
+    const uint32_t three_runs_tid[] = { 1, 1, 2, 2, 3, 3 };
+
+    if (!trace_sorted_as(two_runs, 6, two_runs_time, two_runs_tid)
+        || !trace_sorted_as(three_runs, 6, three_runs_time, three_runs_tid)) {
+        printf("Test trace sort failed: records are out of order. \n");
+        return false;
+    }
+    printf("Test trace sort passed! \n");
+    return true;
+}
+
+// отчёт trace_analysis_report по синтетической трассе в report; false, если отчёта нет
+static bool analysis_report(struct trace_record const* records, size_t count, char* report, size_t size) {
+    char path[] = "/tmp/mem-trace-XXXXXX";
+    struct trace_file t;
+    const bool opened = write_trace(path, records, count) && trace_file_open(path, &t);
+    unlink(path);
+    FILE* out = tmpfile();
+    const bool reported = opened && out != NULL && trace_analysis_report(&t, out);
+    if (opened) trace_file_close(&t);
+    memset(report, 0, size);
+    if (out != NULL) {
+        rewind(out);
+        fread(report, 1, size - 1, out);
+        fclose(out);
+    }
+    return reported;
+}
+
+// отчёт начинается со счётчиков, в нём нет неизвестных освобождений, есть строка пика,
+// выбранные классы и заканчивается он строкой MEM_CONF с этими классами
+static bool analysis_matches(const char* report, const char* peak, const char* classes, const char* conf_classes) {
+    char conf[256];
+    snprintf(conf, sizeof(conf), "\nMEM_CONF=heap_size=4096,region_min=%d,mmap_threshold=131072,"
+             "trim_threshold=262144,cache_size=8,size_classes=%s\n", REGION_MIN_SIZE, conf_classes);
+    const size_t length = strlen(report), conf_length = strlen(conf);
+    return strstr(report, "# trace: 3 mallocs, 3 frees, 0 reallocs, 0 grows") == report
+        && strstr(report, "allocated before the trace started") == NULL
+        && strstr(report, peak) != NULL && strstr(report, classes) != NULL
+        && length >= conf_length && strcmp(report + length - conf_length, conf) == 0;
+}
+
+// Разбор трасс: блок одного потока освобождает другой, и его кусок в файле идёт раньше.
+// После упорядочения по timestamp все освобождения находят свои блоки, а отчёт заканчивается
+// рекомендуемым MEM_CONF. Вторая трасса -- три куска сброса, которые сливаются за два прохода.
+static bool test_trace_analysis() {
+    printf("Test trace analysis: report and recommended MEM_CONF...\n");
+    const struct trace_record two_chunks[] = {
+        { .timestamp = 40, .ptr = 0x1000, .tid = 2, .op = TRACE_FREE },
+        { .timestamp = 50, .ptr = 0x3000, .tid = 2, .op = TRACE_MALLOC, .size = 100 },
+        { .timestamp = 60, .ptr = 0x3000, .tid = 2, .op = TRACE_FREE },
+        { .timestamp = 10, .ptr = 0x1000, .tid = 1, .op = TRACE_MALLOC, .size = 48 },
+        { .timestamp = 20, .ptr = 0x2000, .tid = 1, .op = TRACE_MALLOC, .size = 48 },
+        { .timestamp = 30, .ptr = 0x2000, .tid = 1, .op = TRACE_FREE },
+    };
+    const struct trace_record three_chunks[] = {
+        { .timestamp = 50, .ptr = 0x2000, .tid = 3, .op = TRACE_FREE },
+        { .timestamp = 60, .ptr = 0x3000, .tid = 3, .op = TRACE_FREE },
+        { .timestamp = 30, .ptr = 0x1000, .tid = 2, .op = TRACE_FREE },
+        { .timestamp = 40, .ptr = 0x3000, .tid = 2, .op = TRACE_MALLOC, .size = 200 },
+        { .timestamp = 10, .ptr = 0x1000, .tid = 1, .op = TRACE_MALLOC, .size = 64 },
+        { .timestamp = 20, .ptr = 0x2000, .tid = 1, .op = TRACE_MALLOC, .size = 64 },
+    };
+    char report[4096];
+    if (!analysis_report(two_chunks, sizeof(two_chunks) / sizeof(two_chunks[0]), report, sizeof(report))
+        || !analysis_matches(report, "# peak live: 100 bytes in 2 blocks;", "bytes with 48 112\n", "48:112")) {
+        printf("Test trace analysis failed: unexpected report for two chunks:\n%s", report);
+        return false;
+    }
+    if (!analysis_report(three_chunks, sizeof(three_chunks) / sizeof(three_chunks[0]), report, sizeof(report))
+        || !analysis_matches(report, "# peak live: 264 bytes in 2 blocks;", "bytes with 64 208\n", "64:208")) {
+        printf("Test trace analysis failed: unexpected report for three chunks:\n%s", report);
+        return false;
+    }
+    printf("Test trace analysis passed! \n");
+    return true;
+}
+
+// сумма байт по всем строкам свёрнутого профиля (последнее поле каждой строки)
+static size_t profile_dump_bytes(bool* well_formed) {
+    FILE* f = tmpfile();
+    *well_formed = f != NULL && heap_profile_dump(fileno(f));
+    if (f == NULL) return 0;
+    rewind(f);
+    size_t total = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        const char* space = strrchr(line, ' ');
+        if (space == NULL) { *well_formed = false; break; }
+        total += strtoull(space + 1, NULL, 10);
+    }
+    fclose(f);
+    return total;
+}
+
+// Профиль: оценка живых байт по выборке близка к настоящей и обнуляется после освобождения.
+static bool test_heap_profile() {
+    printf("Test profile: sampled heap profile...\n");
+    enum { BLOCKS = 1000, SIZE = 1024 };
+    const size_t rate = 4096;
+    _mallopt(MEM_OPT_PROFILE_RATE, rate);
+    profile_countdown = 0;
+    void* blocks[BLOCKS];
+    for (size_t i = 0; i < BLOCKS; i++) blocks[i] = _malloc(SIZE);
+
+    bool well_formed;
+    const size_t live = profile_dump_bytes(&well_formed);
+    for (size_t i = 0; i < BLOCKS; i++) _free(blocks[i]);
+    bool empty_well_formed;
+    const size_t after_free = profile_dump_bytes(&empty_well_formed);
+    _mallopt(MEM_OPT_PROFILE_RATE, 0);
+
+    // около BLOCKS * SIZE / rate = 250 выборок: относительная погрешность порядка 6%
+    const size_t expected = BLOCKS * SIZE;
+    if (!well_formed || !empty_well_formed || live < expected * 7 / 10 || live > expected * 13 / 10) {
+        printf("Test profile failed: estimated %zu live bytes instead of about %zu. \n", live, expected);
+        return false;
+    }
+    if (after_free != 0 || profile_dropped() != 0) {
+        printf("Test profile failed: freed blocks stayed in the profile. \n");
+        return false;
+    }
+
+    // блоки, выданные кэшем потока при промахе, попадают в выборку и уходят из неё при
+    // освобождении в магазин, а не при сбросе магазина; в профиле остаётся только сам магазин
+    tcache_flush();
+    tcache_depot_release();
+    _mallopt(MEM_OPT_PROFILE_RATE, 1);
+    profile_countdown = 0;
+    void* cached = tcache_malloc(SIZE);
+    void* cached_sized = tcache_malloc(SIZE);
+    tcache_free(cached);
+    tcache_free_sized(cached_sized, SIZE);
+    const size_t after_cache = profile_dump_bytes(&empty_well_formed);
+    _mallopt(MEM_OPT_PROFILE_RATE, 0);
+    if (block_get_header(cached)->is_sampled || block_get_header(cached_sized)->is_sampled || after_cache >= SIZE) {
+        printf("Test profile failed: blocks freed into the thread cache stayed in the profile. \n");
+        return false;
+    }
+    printf("Test profile passed! \n");
+    return true;
+}
+
+// Отчёт об утечках: учтены все занятые блоки, а блоки из одного места выделения делят site.
+static bool test_leak_report() {
+    printf("Test leaks: leak report by allocation site...\n");
+    void* blocks[3];
+    for (size_t i = 0; i < 3; i++) blocks[i] = _malloc(200);
+    // кэш потока и депо опустошаются, чтобы все занятые блоки были видны отчёту как утечки
+    tcache_flush();
+    tcache_depot_release();
+    const size_t used = heap_stats().used_blocks;
+
+    FILE* f = tmpfile();
+    const size_t reported = f ? heap_leak_report(f) : 0;
+    bool header_found = false;
+    if (f) {
+        char line[256];
+        rewind(f);
+        header_found = fgets(line, sizeof(line), f) && strstr(line, "Leaks:") != NULL;
+        fclose(f);
+    }
+    bool ok = reported == used && header_found;
+#ifdef MEM_LEAK_SITES
+    ok = ok && block_get_header(blocks[0])->site != NULL
+            && block_get_header(blocks[1])->site == block_get_header(blocks[0])->site
+            && block_get_header(blocks[2])->site == block_get_header(blocks[0])->site;
+#endif
+    for (size_t i = 0; i < 3; i++) _free(blocks[i]);
+    if (!ok) {
+        printf("Test leaks failed: reported %zu taken blocks, heap has %zu. \n", reported, used);
+        return false;
+    }
+
+    // блоки, освобождённые в кэш потока, идут в отчёте отдельной строкой, а сам отчёт
+    // кэш не трогает: магазины в депо остаются на месте
+    FILE* null = fopen("/dev/null", "w");
+    const size_t before = null ? heap_leak_report(null) : 0;
+    if (null) fclose(null);
+    FILE* sink = tmpfile();
+    void* cached[2 * MAGAZINE_SIZE];
+    for (size_t i = 0; i < 2 * MAGAZINE_SIZE; i++) cached[i] = tcache_malloc(48);
+    for (size_t i = 0; i < 2 * MAGAZINE_SIZE; i++) tcache_free(cached[i]);
+    const size_t magazines = tcache_depot_magazines();
+    const size_t after = sink ? heap_leak_report(sink) : 0;
+    bool cached_line = false;
+    if (sink) {
+        char line[256];
+        rewind(sink);
+        while (fgets(line, sizeof(line), sink)) cached_line = cached_line || strstr(line, "[cached in tcache") != NULL;
+        fclose(sink);
+    }
+    if (null == NULL || sink == NULL || after != before || !cached_line || tcache_depot_magazines() != magazines) {
+        printf("Test leaks failed: %zu cached blocks reported as leaks. \n", after - before);
+        return false;
+    }
+    printf("Test leaks passed! \n");
+    return true;
+}
+
+// число строк дампа, начинающихся с prefix; false в *well_formed, если какая-то строка не начинается с any_line
+static size_t dump_lines(enum heap_dump_format format, struct heap_dump_filter const* filter,
+                         const char* prefix, const char* any_line, bool* well_formed) {
+    FILE* f = tmpfile();
+    *well_formed = f != NULL && heap_dump(fileno(f), format, filter);
+    if (f == NULL) return 0;
+    rewind(f);
+    size_t count = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, prefix, strlen(prefix)) == 0) count++;
+        if (strncmp(line, any_line, strlen(any_line)) != 0) *well_formed = false;
+    }
+    fclose(f);
+    return count;
+}
+
+// Дамп кучи: фильтр свободных блоков выдаёт ровно столько строк, сколько свободных блоков в статистике.
+static bool test_heap_dump() {
+    printf("Test dump: machine-readable heap dump...\n");
+    void* blocks[6];
+    for (size_t i = 0; i < 6; i++) blocks[i] = _malloc(300 + i * 100);
+    _free(blocks[1]);
+    _free(blocks[3]);
+
+    const struct heap_stats stats = heap_stats();
+    const struct heap_dump_filter free_only = { .free_only = true };
+    const struct heap_dump_filter large = { .min_capacity = 700 };
+    bool csv_ok, jsonl_ok, large_ok;
+    const size_t free_rows = dump_lines(HEAP_DUMP_CSV, &free_only, "block,", "", &csv_ok);
+    const size_t json_rows = dump_lines(HEAP_DUMP_JSONL, NULL, "{\"record\": \"block\"", "{", &jsonl_ok);
+    const size_t runs = dump_lines(HEAP_DUMP_JSONL, &large, "{\"record\": \"largest_free_run\"", "{", &large_ok);
+    for (size_t i = 0; i < 6; i++) if (i != 1 && i != 3) _free(blocks[i]);
+
+    if (!csv_ok || !jsonl_ok || !large_ok || runs != 1) {
+        printf("Test dump failed: malformed dump. \n");
+        return false;
+    }
+    if (free_rows != stats.free_blocks || json_rows != stats.free_blocks + stats.used_blocks) {
+        printf("Test dump failed: %zu free and %zu total rows for %zu free and %zu used blocks. \n",
+               free_rows, json_rows, stats.free_blocks, stats.used_blocks);
+        return false;
+    }
+    printf("Test dump passed! \n");
+    return true;
+}
+
+// Проверка кучи: несклеенные соседи -- не порча, испорченные next и capacity находятся без падения.
+static bool test_heap_check() {
+    printf("Test check: heap consistency checker...\n");
+    void* blocks[4];
+    for (size_t i = 0; i < 4; i++) blocks[i] = _malloc(500);
+    // _free сливает только вперёд: blocks[0] и blocks[1] остаются соседними свободными блоками
+    _free(blocks[0]);
+    _free(blocks[1]);
+    const struct heap_check_report clean = heap_check();
+
+    struct block_header* header = block_get_header(blocks[2]);
+    struct block_header* const next = header->next;
+    header->next = (struct block_header*) 0x10;
+    const struct heap_check_report wild = heap_check();
+    header->next = next;
+    header->capacity.bytes += 8;
+    const struct heap_check_report resized = heap_check();
+    header->capacity.bytes -= 8;
+
+    // непрерывный режим: проверка на каждой операции
+    _mallopt(MEM_OPT_CHECK_INTERVAL, 1);
+    for (size_t i = 0; i < 100; i++) _free(_malloc(64 + i * 32));
+    _mallopt(MEM_OPT_CHECK_INTERVAL, 0);
+    _free(blocks[2]);
+    _free(blocks[3]);
+    const struct heap_check_report after = heap_check();
+
+    if (clean.errors != 0 || clean.uncoalesced == 0 || clean.blocks == 0 || after.errors != 0) {
+        printf("Test check failed: a valid heap was reported as corrupted (%s). \n",
+               clean.problem ? clean.problem : after.problem);
+        return false;
+    }
+    if (wild.errors != 1 || wild.bad_block != header || strstr(wild.problem, "outside") == NULL
+        || resized.errors != 1 || resized.bad_block != header) {
+        printf("Test check failed: corrupted headers were not found. \n");
+        return false;
+    }
+    printf("Test check passed! \n");
+    return true;
+}
+
+// Снимок кучи: записи совпадают со списком блоков, выделенный блок виден с вместимостью и флагом.
+static bool test_heap_snapshot() {
+    printf("Test snapshot: binary heap snapshot...\n");
+    void* block = _malloc(777);
+    const struct heap_stats stats = heap_stats();
+    char path[] = "/tmp/mem-snapshot-XXXXXX";
+    const int fd = mkstemp(path);
+    const bool written = fd >= 0 && heap_snapshot(fd);
+    if (fd >= 0) close(fd);
+
+    struct snapshot_file s;
+    const bool opened = written && snapshot_file_open(path, &s);
+    unlink(path);
+    if (!opened) {
+        _free(block);
+        printf("Test snapshot failed: snapshot wasn't written. \n");
+        return false;
+    }
+    size_t free_blocks = 0;
+    bool found = false;
+    for (size_t i = 0; i < s.count; i++) {
+        const struct snapshot_record r = snapshot_file_record(&s, i);
+        if (r.capacity & SNAPSHOT_FREE_BIT) free_blocks++;
+        if (r.address == (uintptr_t) block_get_header(block) && r.capacity == block_get_header(block)->capacity.bytes)
+            found = true;
+    }
+    const size_t count = s.count;
+    snapshot_file_close(&s);
+    _free(block);
+    if (!found || count != stats.free_blocks + stats.used_blocks || free_blocks != stats.free_blocks) {
+        printf("Test snapshot failed: %zu records for %zu blocks. \n", count, stats.free_blocks + stats.used_blocks);
+        return false;
+    }
+    printf("Test snapshot passed! \n");
+    return true;
+}
+
+// Выравнивание: обычные блоки выровнены на 16 байт, _malloc_aligned -- на запрошенную степень двойки.
+static bool test_aligned_malloc() {
+    printf("Test aligned: 16-byte blocks and _malloc_aligned...\n");
+    bool ok = true;
+    void* plain[8];
+    for (size_t i = 0; i < 8; i++) {
+        plain[i] = _malloc(1 + i * 13);
+        if ((uintptr_t) plain[i] % 16 != 0) ok = false;
+    }
+    void* aligned[6];
+    for (size_t i = 0; i < 6; i++) {
+        const size_t alignment = (size_t) 32 << (2 * i);
+        aligned[i] = _malloc_aligned(alignment, 100 + i);
+        if (aligned[i] == NULL || (uintptr_t) aligned[i] % alignment != 0
+            || block_get_header(aligned[i])->capacity.bytes < 100 + i) ok = false;
+    }
+    const bool rejected = _malloc_aligned(48, 10) == NULL;
+    const struct heap_check_report report = heap_check();
+    for (size_t i = 0; i < 6; i++) _free(aligned[i]);
+    for (size_t i = 0; i < 8; i++) _free(plain[i]);
+    if (!ok || !rejected || report.errors != 0) {
+        printf("Test aligned failed: misaligned block or broken heap (%s). \n", report.problem ? report.problem : "-");
+        return false;
+    }
+    printf("Test aligned passed! \n");
+    return true;
+}
+
 typedef bool (*tests)();
-tests my_tests_array[5] = {test_1, test_2, test_3, test_4, test_5};
+tests my_tests_array[] = {test_1, test_2, test_3, test_4, test_5, test_slab_stress,
+                         test_depot_rebalance, test_tcache_free_sized, test_free_sized, test_batch, test_numa_arenas, test_heap_reserve,
+                         test_runtime_config, test_heap_stats,
+                         test_size_histogram, test_latency_histograms,
+                         test_realloc, test_trace, test_trace_sort, test_trace_analysis, test_heap_profile,
+                         test_leak_report, test_heap_dump, test_heap_check,
+                         test_heap_snapshot, test_aligned_malloc};
 
+#define TESTS_COUNT (sizeof(my_tests_array) / sizeof(my_tests_array[0]))
 
-void run_tests() {
+bool run_tests() {
+    const bool lazy_init_passed = test_lazy_init();
     memory_heap = heap_init(500);
 
-    if (memory_heap == NULL)
+    if (memory_heap == NULL) {
         printf("Error during initialization start memory heap :(");
-    else {
-        printf("Tests started...\n");
-        size_t test_passed = 0;
-
-        for (size_t i = 0; i < 5; i++) {
+        return false;
+    }
+    printf("Tests started...\n");
+    size_t test_passed = 0;
 
-            if (my_tests_array[i]())
-                test_passed++;
+    for (size_t i = 0; i < TESTS_COUNT; i++) {
 
-        }       
+        if (my_tests_array[i]())
+            test_passed++;
 
-        printf("Passed %zu of 5 tests ^..^ \n", test_passed);
     }
 
+    printf("Passed %zu of %zu tests ^..^ \n", test_passed, TESTS_COUNT);
+    return lazy_init_passed && test_passed == TESTS_COUNT;
 }
 
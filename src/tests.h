@@ -4,6 +4,6 @@
 
 #include <stdbool.h>
 
-void run_tests();
+bool run_tests();
 
 #endif //ASSIGNMENT_MEMORY_ALLOCATOR_TESTS_H
@@ -0,0 +1,76 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Бинарная трасса аллокаций. Каждое событие _malloc/_free/_realloc и каждый рост кучи пишется
+    записью фиксированного размера в кольцевой буфер своего потока; фоновый поток-писатель
+    периодически сбрасывает все буферы в файл. Если буфер переполнен, событие отбрасывается
+    и учитывается в trace_dropped, поток при этом никогда не ждёт писателя.
+
+    Файл: trace_file_header, за ним записи trace_record в порядке сброса (внутри одного потока
+    порядок сохраняется, между потоками его восстанавливают по timestamp). */
+
+#define TRACE_MAGIC "MEMTRACE"
+#define TRACE_VERSION 1
+#define TRACE_RING_RECORDS 8192
+#define TRACE_FLUSH_INTERVAL_NS 10000000
+
+enum trace_op { TRACE_MALLOC = 1, TRACE_FREE, TRACE_REALLOC, TRACE_GROW };
+
+/*  для malloc: ptr -- результат, size -- запрос; free: ptr; realloc: ptr -- результат, old_ptr -- исходный
+    указатель, size -- запрос; grow: ptr и size -- новый регион. timestamp -- CLOCK_MONOTONIC в наносекундах */
+struct trace_record {
+  uint64_t timestamp;
+  uint64_t ptr;
+  uint64_t old_ptr;
+  uint64_t size;
+  uint32_t tid;
+  uint16_t op;
+  uint16_t reserved;
+};
+
+struct trace_file_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t record_size;
+};
+
+/*  записанная трасса, отображённая в память только для чтения */
+struct trace_file {
+  uint8_t*                   base;
+  size_t                     length;
+  struct trace_record const* records;
+  size_t                     count;
+};
+
+extern _Atomic bool trace_enabled;
+
+bool     trace_start( const char* path );
+void     trace_stop( void );
+/*  вокруг fork: в ребёнке трасса выключена, писателя и файла родителя у него нет */
+void     trace_fork_prepare( void );
+void     trace_fork_parent( void );
+void     trace_fork_child( void );
+uint64_t trace_dropped( void );
+
+void     trace_event( enum trace_op op, void const* ptr, void const* old_ptr, uint64_t size );
+
+/*  false, если файла нет или это не трасса с записями текущего формата */
+bool     trace_file_open( const char* path, struct trace_file* t );
+void     trace_file_close( struct trace_file* t );
+/*  переставить записи в порядке timestamp, сливая куски сброса разных потоков (внутри потока
+    порядок не меняется); false, если не хватило памяти -- тогда трасса остаётся как была */
+bool     trace_file_sort( struct trace_file* t );
+
+/*  выключенная трасса стоит одной загрузки и предсказуемого перехода */
+#define TRACE_EVENT( op, ptr, old_ptr, size ) \
+  do { \
+    if (__builtin_expect( atomic_load_explicit( &trace_enabled, memory_order_relaxed ), 0 )) \
+      trace_event( (op), (ptr), (old_ptr), (size) ); \
+  } while (0)
+
+#endif
@@ -0,0 +1,278 @@
+#define _DEFAULT_SOURCE
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include "latency.h"
+#include "mem_internals.h"
+#include "sizehist.h"
+#include "tcache.h"
+#include "trace.h"
+#include "trace_analysis.h"
+
+/*  размерные классы подбираются с шагом CLASS_STEP: мельче делить нет смысла из-за выравнивания */
+#define CLASS_STEP 16
+#define CLASS_BINS (TCACHE_MAX_SIZE / CLASS_STEP)
+
+#define CACHE_SIZE_MIN 8
+#define CACHE_SIZE_MAX 256
+#define REGION_MIN_MAX ((size_t) 64 << 20)
+#define MMAP_THRESHOLD_MIN ((size_t) 128 << 10)
+
+struct live_slot {
+  uint64_t ptr;
+  uint64_t size;
+  uint64_t born_ns;
+  uint64_t born_op;
+};
+
+#define SLOT_EMPTY 0
+#define SLOT_DELETED 1
+
+struct live_map {
+  struct live_slot* slots;
+  size_t            mask;
+};
+
+struct analysis {
+  size_t   mallocs, frees, reallocs, grows, unknown_frees;
+  uint64_t requested_bytes;
+  uint64_t live, peak_live;
+  size_t   live_blocks, peak_live_blocks;
+  uint64_t grown_bytes;
+  uint64_t first_ns, last_ns;
+
+  struct size_bucket       sizes[SIZE_BUCKETS];
+  /*  запросы до TCACHE_MAX_SIZE, округлённые вверх до CLASS_STEP: число и сумма запрошенных байт */
+  uint64_t                 bin_count[CLASS_BINS + 1];
+  uint64_t                 bin_bytes[CLASS_BINS + 1];
+  struct latency_histogram lifetime_ns;
+  struct latency_histogram lifetime_ops;
+};
+
+static size_t hash_pointer( uint64_t p ) { return (size_t) ((p >> 4) * 0x9E3779B97F4A7C15ull); }
+
+static bool map_create( struct live_map* m, size_t records ) {
+  size_t capacity = 1024;
+  while (capacity < 2 * records) capacity <<= 1;
+  m->slots = mmap( NULL, capacity * sizeof( struct live_slot ), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+  m->mask = capacity - 1;
+  return m->slots != MAP_FAILED;
+}
+
+static void map_destroy( struct live_map* m ) { munmap( m->slots, (m->mask + 1) * sizeof( struct live_slot ) ); }
+
+static void map_put( struct live_map* m, struct live_slot slot ) {
+  for (size_t i = hash_pointer( slot.ptr ) & m->mask;; i = (i + 1) & m->mask)
+    if (m->slots[i].ptr <= SLOT_DELETED || m->slots[i].ptr == slot.ptr) {
+      m->slots[i] = slot;
+      return;
+    }
+}
+
+static bool map_take( struct live_map* m, uint64_t ptr, struct live_slot* out ) {
+  for (size_t i = hash_pointer( ptr ) & m->mask; m->slots[i].ptr != SLOT_EMPTY; i = (i + 1) & m->mask)
+    if (m->slots[i].ptr == ptr) {
+      *out = m->slots[i];
+      m->slots[i].ptr = SLOT_DELETED;
+      return true;
+    }
+  return false;
+}
+
+static void note_alloc( struct analysis* a, struct live_map* m, struct trace_record const* rec, size_t op ) {
+  if (!rec->ptr) return;
+  const size_t b = size_bucket_index( rec->size );
+  a->sizes[b].allocs++;
+  a->sizes[b].bytes += rec->size;
+  if (rec->size <= TCACHE_MAX_SIZE) {
+    const size_t bin = (rec->size + CLASS_STEP - 1) / CLASS_STEP;
+    a->bin_count[bin]++;
+    a->bin_bytes[bin] += rec->size;
+  }
+  a->requested_bytes += rec->size;
+  a->live += rec->size;
+  a->live_blocks++;
+  if (a->live > a->peak_live) a->peak_live = a->live;
+  if (a->live_blocks > a->peak_live_blocks) a->peak_live_blocks = a->live_blocks;
+  map_put( m, (struct live_slot) { rec->ptr, rec->size, rec->timestamp, op } );
+}
+
+/*  false, если блок был выделен до начала трассы */
+static bool note_free( struct analysis* a, struct live_map* m, uint64_t ptr, uint64_t now_ns, size_t op ) {
+  struct live_slot slot;
+  if (!map_take( m, ptr, &slot )) return false;
+  a->live -= slot.size;
+  a->live_blocks--;
+  latency_histogram_record( &a->lifetime_ns, now_ns > slot.born_ns ? now_ns - slot.born_ns : 0 );
+  latency_histogram_record( &a->lifetime_ops, op - slot.born_op );
+  return true;
+}
+
+static bool analyze( struct trace_file const* t, struct analysis* a ) {
+  struct live_map m;
+  if (!map_create( &m, t->count )) return false;
+  for (size_t i = 0; i < t->count; i++) {
+    struct trace_record const* rec = &t->records[i];
+    if (i == 0 || rec->timestamp < a->first_ns) a->first_ns = rec->timestamp;
+    if (rec->timestamp > a->last_ns) a->last_ns = rec->timestamp;
+    switch (rec->op) {
+      case TRACE_MALLOC:
+        a->mallocs++;
+        note_alloc( a, &m, rec, i );
+        break;
+      case TRACE_FREE:
+        a->frees++;
+        if (rec->ptr && !note_free( a, &m, rec->ptr, rec->timestamp, i )) a->unknown_frees++;
+        break;
+      case TRACE_REALLOC:
+        /*  realloc считается освобождением старого блока и выделением нового */
+        a->reallocs++;
+        if (rec->old_ptr) note_free( a, &m, rec->old_ptr, rec->timestamp, i );
+        note_alloc( a, &m, rec, i );
+        break;
+      case TRACE_GROW:
+        a->grows++;
+        a->grown_bytes += rec->size;
+        break;
+    }
+  }
+  map_destroy( &m );
+  return true;
+}
+
+/*  верхняя граница корзины, в которую попадает запрос с рангом percentile */
+static size_t size_percentile( struct analysis const* a, double percentile ) {
+  uint64_t total = 0;
+  for (size_t b = 0; b < SIZE_BUCKETS; b++) total += a->sizes[b].allocs;
+  const uint64_t rank = (uint64_t) (percentile / 100.0 * (double) total);
+  uint64_t seen = 0;
+  for (size_t b = 0; b + 1 < SIZE_BUCKETS; b++) {
+    seen += a->sizes[b].allocs;
+    if (seen > rank) return size_bucket_lower( b + 1 ) - 1;
+  }
+  return SIZE_MAX;
+}
+
+static size_t round_up_pow2( size_t x ) {
+  size_t p = 1;
+  while (p < x) p <<= 1;
+  return p;
+}
+
+static size_t clamp( size_t x, size_t lo, size_t hi ) { return x < lo ? lo : x > hi ? hi : x; }
+
+/*  потери на округление, если все запросы из корзин (from, to] получают класс to */
+static uint64_t class_waste( struct analysis const* a, size_t from, size_t to ) {
+  uint64_t waste = 0;
+  for (size_t bin = from + 1; bin <= to; bin++)
+    waste += a->bin_count[bin] * (to * CLASS_STEP) - a->bin_bytes[bin];
+  return waste;
+}
+
+/*  потери на округление для произвольной таблицы классов; запросы больше последнего класса не считаются */
+static uint64_t table_waste( struct analysis const* a, size_t const* classes, size_t count ) {
+  uint64_t waste = 0;
+  for (size_t bin = 1; bin <= CLASS_BINS; bin++) {
+    size_t c = 0;
+    while (c < count && classes[c] < bin * CLASS_STEP) c++;
+    if (c == count) break;
+    waste += a->bin_count[bin] * classes[c] - a->bin_bytes[bin];
+  }
+  return waste;
+}
+
+/*  не больше TCACHE_CLASSES классов, последний -- наибольший встреченный размер до TCACHE_MAX_SIZE.
+    best[k][j] -- наименьшие потери, если k классов покрывают корзины 1..j и последний класс равен j */
+static size_t choose_classes( struct analysis const* a, size_t classes[TCACHE_CLASSES] ) {
+  size_t top = CLASS_BINS;
+  while (top > 0 && a->bin_count[top] == 0) top--;
+  if (top == 0) return 0;
+
+  static uint64_t best[TCACHE_CLASSES + 1][CLASS_BINS + 1];
+  static size_t   from[TCACHE_CLASSES + 1][CLASS_BINS + 1];
+  for (size_t k = 0; k <= TCACHE_CLASSES; k++)
+    for (size_t j = 0; j <= top; j++) best[k][j] = UINT64_MAX;
+  best[0][0] = 0;
+  for (size_t k = 1; k <= TCACHE_CLASSES; k++)
+    for (size_t j = 1; j <= top; j++)
+      for (size_t i = 0; i < j; i++) {
+        if (best[k - 1][i] == UINT64_MAX) continue;
+        const uint64_t cost = best[k - 1][i] + class_waste( a, i, j );
+        if (cost < best[k][j]) { best[k][j] = cost; from[k][j] = i; }
+      }
+
+  size_t k_best = 1;
+  for (size_t k = 1; k <= TCACHE_CLASSES; k++)
+    if (best[k][top] < best[k_best][top]) k_best = k;
+
+  size_t j = top;
+  for (size_t k = k_best; k > 0; k--) {
+    classes[k - 1] = j * CLASS_STEP;
+    j = from[k][j];
+  }
+  return k_best;
+}
+
+static void report( struct analysis const* a, FILE* out ) {
+  const size_t header = offsetof( struct block_header, contents );
+  const size_t page = 4096;
+  const double seconds = (double) (a->last_ns - a->first_ns) / 1e9;
+
+  fprintf( out, "# trace: %zu mallocs, %zu frees, %zu reallocs, %zu grows over %.3f s\n",
+           a->mallocs, a->frees, a->reallocs, a->grows, seconds );
+  if (a->unknown_frees)
+    fprintf( out, "# %zu frees of blocks allocated before the trace started were ignored\n", a->unknown_frees );
+  fprintf( out, "# request size: p50 <= %zu, p90 <= %zu, p99 <= %zu, p99.9 <= %zu bytes\n",
+           size_percentile( a, 50 ), size_percentile( a, 90 ), size_percentile( a, 99 ), size_percentile( a, 99.9 ) );
+  fprintf( out, "# lifetime: p50 %" PRIu64 " ns / %" PRIu64 " ops, p90 %" PRIu64 " ns / %" PRIu64 " ops, "
+           "p99 %" PRIu64 " ns / %" PRIu64 " ops\n",
+           latency_histogram_percentile( &a->lifetime_ns, 50 ), latency_histogram_percentile( &a->lifetime_ops, 50 ),
+           latency_histogram_percentile( &a->lifetime_ns, 90 ), latency_histogram_percentile( &a->lifetime_ops, 90 ),
+           latency_histogram_percentile( &a->lifetime_ns, 99 ), latency_histogram_percentile( &a->lifetime_ops, 99 ) );
+
+  /*  идеальная куча держит ровно пик живых блоков вместе с их заголовками */
+  const uint64_t ideal = a->peak_live + a->peak_live_blocks * header;
+  fprintf( out, "# peak live: %" PRIu64 " bytes in %zu blocks; ideal heap %" PRIu64 " bytes, grown by %" PRIu64 " bytes",
+           a->peak_live, a->peak_live_blocks, ideal, a->grown_bytes );
+  if (a->grown_bytes && ideal) fprintf( out, " (%.2fx)", (double) a->grown_bytes / (double) ideal );
+  fprintf( out, "\n" );
+
+  size_t classes[TCACHE_CLASSES];
+  const size_t class_count = choose_classes( a, classes );
+  if (class_count) {
+    fprintf( out, "# size classes: rounding waste %" PRIu64 " bytes with current, %" PRIu64 " bytes with",
+             table_waste( a, mem_config.size_classes, mem_config.size_class_count ),
+             table_waste( a, classes, class_count ) );
+    for (size_t c = 0; c < class_count; c++) fprintf( out, " %zu", classes[c] );
+    fprintf( out, "\n" );
+  }
+
+  const size_t p999 = size_percentile( a, 99.9 );
+  const size_t mmap_threshold = p999 > MMAP_THRESHOLD_MIN ? round_up_pow2( p999 + 1 ) : MMAP_THRESHOLD_MIN;
+  const size_t heap_size = (ideal + page - 1) / page * page;
+  const size_t region_min = clamp( round_up_pow2( a->peak_live / 16 ), REGION_MIN_SIZE, REGION_MIN_MAX );
+  const size_t cache_size = clamp( round_up_pow2( latency_histogram_percentile( &a->lifetime_ops, 50 ) ),
+                                   CACHE_SIZE_MIN, CACHE_SIZE_MAX );
+
+  fprintf( out, "MEM_CONF=heap_size=%zu,region_min=%zu,mmap_threshold=%zu,trim_threshold=%zu,cache_size=%zu",
+           heap_size, region_min, mmap_threshold, 2 * mmap_threshold, cache_size );
+  for (size_t c = 0; c < class_count; c++) fprintf( out, "%s%zu", c ? ":" : ",size_classes=", classes[c] );
+  fprintf( out, "\n" );
+}
+
+bool trace_analysis_report( struct trace_file* t, FILE* out ) {
+  /*  куски сброса разных потоков идут в файле подряд: время жизни и пик живых байт
+      считаются только по записям, упорядоченным по timestamp */
+  if (!trace_file_sort( t )) return false;
+  mem_config_load();
+  static struct analysis a;
+  a = (struct analysis) {0};
+  if (!analyze( t, &a )) return false;
+  report( &a, out );
+  return true;
+}
@@ -0,0 +1,20 @@
+#ifndef _TRACE_ANALYSIS_H_
+#define _TRACE_ANALYSIS_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "trace.h"
+
+/*  Разбор записанной трассы (trace.h) и подбор настроек под неё.
+    Считаются распределение размеров запросов, время жизни блоков (в наносекундах и в числе операций
+    между выделением и освобождением), пик живых байт и итоговый рост кучи. По ним подбираются
+    размерные классы кэша потока (динамическим программированием по потерям на округление),
+    mmap_threshold, trim_threshold, heap_size, region_min и cache_size.
+    Отчёт печатается строками "# ...", последняя строка -- готовое значение MEM_CONF. */
+
+/*  записи трассы сначала упорядочиваются по timestamp (trace_file_sort);
+    false, если не хватило памяти */
+bool trace_analysis_report( struct trace_file* t, FILE* out );
+
+#endif
@@ -0,0 +1,24 @@
+#include <stdio.h>
+
+#include "trace.h"
+#include "trace_analysis.h"
+
+/*  trace_analyze <трасса>: отчёт и рекомендуемый MEM_CONF */
+int main( int argc, char** argv ) {
+  if (argc != 2) {
+    fprintf( stderr, "usage: %s <trace>\n", argv[0] );
+    return 2;
+  }
+  struct trace_file t;
+  if (!trace_file_open( argv[1], &t )) {
+    fprintf( stderr, "%s: not a readable allocation trace\n", argv[1] );
+    return 1;
+  }
+  const bool ok = trace_analysis_report( &t, stdout );
+  trace_file_close( &t );
+  if (!ok) {
+    fprintf( stderr, "out of memory\n" );
+    return 1;
+  }
+  return 0;
+}
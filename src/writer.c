@@ -0,0 +1,58 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <unistd.h>
+
+#include "mem.h"
+#include "writer.h"
+
+bool writer_open( struct writer* w, int fd, size_t capacity ) {
+  *w = (struct writer) { .fd = fd, .capacity = capacity };
+  w->buffer = map_pages( NULL, capacity, 0 );
+  if (w->buffer == MAP_FAILED) { w->buffer = NULL; return false; }
+  return true;
+}
+
+bool writer_close( struct writer* w ) {
+  writer_flush( w );
+  if (w->buffer) munmap( w->buffer, w->capacity );
+  w->buffer = NULL;
+  return !w->failed;
+}
+
+void writer_flush( struct writer* w ) {
+  for (size_t done = 0; done < w->length && !w->failed;) {
+    const ssize_t n = write( w->fd, w->buffer + done, w->length - done );
+    if (n <= 0) w->failed = true;
+    else done += n;
+  }
+  w->length = 0;
+}
+
+void writer_put( struct writer* w, const char* data, size_t length ) {
+  while (length > 0 && !w->failed) {
+    if (w->length == w->capacity) writer_flush( w );
+    const size_t chunk = length < w->capacity - w->length ? length : w->capacity - w->length;
+    memcpy( w->buffer + w->length, data, chunk );
+    w->length += chunk;
+    data += chunk;
+    length -= chunk;
+  }
+}
+
+void writer_string( struct writer* w, const char* s ) { writer_put( w, s, strlen( s ) ); }
+
+void writer_decimal( struct writer* w, uint64_t x ) {
+  char text[20];
+  size_t i = sizeof( text );
+  do { text[--i] = (char) ('0' + x % 10); x /= 10; } while (x);
+  writer_put( w, text + i, sizeof( text ) - i );
+}
+
+void writer_hex( struct writer* w, uint64_t x ) {
+  char text[2 + 2 * sizeof( x )];
+  size_t i = sizeof( text );
+  do { text[--i] = "0123456789abcdef"[x & 15]; x >>= 4; } while (x);
+  text[--i] = 'x';
+  text[--i] = '0';
+  writer_put( w, text + i, sizeof( text ) - i );
+}
@@ -0,0 +1,31 @@
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Буферизованный вывод в файловый дескриптор без stdio и без обращений к куче: буфер берётся
+    через map_pages, поэтому им можно пользоваться, описывая саму кучу (профиль, дамп, снимок).
+    Ошибка записи запоминается, дальнейший вывод молча отбрасывается. */
+
+struct writer {
+  int    fd;
+  bool   failed;
+  size_t length;
+  size_t capacity;
+  char*  buffer;
+};
+
+bool writer_open( struct writer* w, int fd, size_t capacity );
+/*  сбросить остаток и освободить буфер; false, если какая-то запись не удалась */
+bool writer_close( struct writer* w );
+
+void writer_flush( struct writer* w );
+void writer_put( struct writer* w, const char* data, size_t length );
+void writer_string( struct writer* w, const char* s );
+void writer_decimal( struct writer* w, uint64_t x );
+/*  "0x..." */
+void writer_hex( struct writer* w, uint64_t x );
+
+#endif